@@ -1,182 +1,3853 @@
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <latch>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <random>
 #include <ranges>
-#include <sstream>
+#include <regex>
 #include <set>
+#include <span>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE4_2__) || defined(_MSC_VER)
+#include <nmmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "concurrentqueue.h"
 
-float parse_float(std::string_view input) {
-    float result = 0.0f;
+[[nodiscard]] std::int16_t parse_tenths(std::string_view input) {
+    auto result = 0;
 
-    float multiplier = 0.1f;
-    for (char c : std::ranges::reverse_view(input)) {
-        if (c == '-') {
-            result *= -1.0f;
-        } else if (c != '.') {
-            result += static_cast<float>(c - '0') * multiplier;
-            multiplier *= 10.0f;
+    for (char c : input) {
+        if (c != '-' && c != '.') {
+            result = result * 10 + (c - '0');
         }
     }
 
-    return result;
+    return static_cast<std::int16_t>(input.front() == '-' ? -result : result);
 }
 
-[[nodiscard]] std::uint64_t name_to_index(const std::string &name) {
-    const auto result = (std::hash<std::string>()(name) * 336043159889533) >> 50;
+[[nodiscard]] std::uint64_t load_prefix(std::string_view name, size_t offset) {
+    auto result = std::uint64_t(0);
+    if (offset < name.size()) {
+        std::memcpy(&result, name.data() + offset, std::min<size_t>(8, name.size() - offset));
+    }
     return result;
 }
 
-struct data_entry {
-    float min = std::numeric_limits<float>::infinity();
-    float max = -std::numeric_limits<float>::infinity();
-    float sum = 0.0f;
-    float count = 0.0f;
+[[nodiscard]] std::uint64_t multiply_high_xor(std::uint64_t a, std::uint64_t b) {
+#if defined(_MSC_VER)
+    auto high = std::uint64_t(0);
+    const auto low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    const auto product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<std::uint64_t>(product) ^ static_cast<std::uint64_t>(product >> 64);
+#endif
+}
+
+struct std_hash {
+    static constexpr auto name = "std::hash";
+
+    [[nodiscard]] static std::uint64_t hash(std::string_view key) {
+        return std::hash<std::string_view>()(key);
+    }
 };
 
-void output_batch(std::set<std::string> &names, std::vector<data_entry> &data) {
-    std::cout << '{';
-    std::cout << std::fixed;
-    std::cout << std::setprecision(1);
-
-    auto it = names.begin();
-    while (it != names.end()) {
-        const auto &entry = data[name_to_index(*it)];
-        std::cout << *it << '=' << entry.min << '/' << entry.sum / entry.count << '/' << entry.max;
-        if (++it != names.end()) {
-            std::cout << ", ";
+// Only the first PrefixBytes bytes and the length take part, so stations
+// sharing a long prefix collide and fall back to the key comparison.
+template <size_t PrefixBytes>
+struct multiply_xorshift_hash {
+    static_assert(PrefixBytes == 8 || PrefixBytes == 16);
+    static constexpr auto name = PrefixBytes == 8 ? "multiply-xorshift-8" : "multiply-xorshift-16";
+
+    [[nodiscard]] static std::uint64_t hash(std::string_view key) {
+        auto result = (load_prefix(key, 0) ^ key.size()) * 0x9e3779b97f4a7c15;
+        if constexpr (PrefixBytes == 16) {
+            result = (result ^ (result >> 29) ^ load_prefix(key, 8)) * 0xbf58476d1ce4e5b9;
         }
+        return result ^ (result >> 32);
     }
-    std::cout << '}';
-}
+};
 
-void process_batch(std::span<std::string> lines, std::vector<data_entry> &data, const std::function<void(std::string_view)> &handle_name) {
-    for (const auto &line : lines) {
-        auto semicolon = size_t(line.size());
-        while (line[--semicolon] != ';');
-        const auto name = std::string(line.begin(), line.begin() + semicolon);
-        handle_name(name);
-        auto &entry = data[name_to_index(name)];
-        const auto measurement = parse_float({line.begin() + semicolon + 1, line.end()});
-        entry.min = measurement < entry.min ? measurement : entry.min;
-        entry.max = measurement > entry.max ? measurement : entry.max;
-        entry.sum += measurement;
-        entry.count += 1.0f;
+struct crc32c_hash {
+#if defined(__SSE4_2__) || defined(_MSC_VER)
+    static constexpr auto name = "crc32c";
+#else
+    static constexpr auto name = "crc32c (software)";
+#endif
+
+    [[nodiscard]] static std::uint64_t hash(std::string_view key) {
+        auto crc = std::uint64_t(~0u);
+        auto offset = size_t(0);
+        for (; offset < key.size(); offset += 8) {
+            crc = step(crc, load_prefix(key, offset));
+        }
+        const auto low = crc ^ key.size();
+        return low | (step(low, 0x9e3779b97f4a7c15) << 32);
+    }
+
+private:
+    [[nodiscard]] static std::uint64_t step(std::uint64_t crc, std::uint64_t value) {
+#if defined(__SSE4_2__) || defined(_MSC_VER)
+        return _mm_crc32_u64(crc, value);
+#else
+        for (size_t i = 0; i < 64; i++) {
+            const auto bit = (crc ^ value) & 1;
+            crc = (crc >> 1) ^ (bit ? 0x82f63b78 : 0);
+            value >>= 1;
+        }
+        return crc;
+#endif
+    }
+};
+
+struct wy_hash {
+    static constexpr auto name = "wyhash";
+
+    [[nodiscard]] static std::uint64_t hash(std::string_view key) {
+        auto seed = std::uint64_t(0xa0761d6478bd642f) ^ key.size();
+        auto offset = size_t(0);
+        for (; offset + 16 < key.size(); offset += 16) {
+            seed = multiply_high_xor(load_prefix(key, offset) ^ 0xe7037ed1a0b428db, load_prefix(key, offset + 8) ^ seed);
+        }
+        return multiply_high_xor(load_prefix(key, offset) ^ 0x8ebc6af09c88c6e3, load_prefix(key, offset + 8) ^ seed);
     }
+};
+
+using station_hash = multiply_xorshift_hash<16>;
+
+// Measurements are kept in tenths of a degree, so every aggregate is exact
+// and independent of how rows were split between threads.
+struct data_entry {
+    std::int64_t sum = 0;
+    std::uint32_t count = 0;
+    std::int16_t min = std::numeric_limits<std::int16_t>::max();
+    std::int16_t max = std::numeric_limits<std::int16_t>::min();
+};
+static_assert(sizeof(data_entry) == 16);
+
+void add_measurement(data_entry &entry, std::int16_t measurement) {
+    entry.min = measurement < entry.min ? measurement : entry.min;
+    entry.max = measurement > entry.max ? measurement : entry.max;
+    entry.sum += measurement;
+    entry.count += 1;
+}
+
+void merge_entry(data_entry &result, const data_entry &against) {
+    result.min = against.min < result.min ? against.min : result.min;
+    result.max = against.max > result.max ? against.max : result.max;
+    result.sum += against.sum;
+    result.count += against.count;
 }
 
-template <size_t MaxBatchSize>
-class buffered_batch_reader {
+constexpr auto cache_line_size = size_t(64);
+
+// Starts every allocation on a cache line and rounds its size up to whole
+// lines, so the edges of one worker's table never share a line with anything
+// another thread writes.
+template <typename T>
+struct cache_aligned_allocator {
+    using value_type = T;
+
+    cache_aligned_allocator() = default;
+
+    template <typename U>
+    explicit cache_aligned_allocator(const cache_aligned_allocator<U> &) {}
+
+    [[nodiscard]] T *allocate(size_t count) {
+        return static_cast<T *>(::operator new(padded_size(count), std::align_val_t(cache_line_size)));
+    }
+
+    void deallocate(T *pointer, size_t count) {
+        ::operator delete(pointer, padded_size(count), std::align_val_t(cache_line_size));
+    }
+
+    bool operator==(const cache_aligned_allocator &) const = default;
+
+private:
+    [[nodiscard]] static size_t padded_size(size_t count) {
+        return (count * sizeof(T) + cache_line_size - 1) / cache_line_size * cache_line_size;
+    }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, cache_aligned_allocator<T>>;
+
+struct array_of_structs {
+    static constexpr auto name = "array-of-structs";
+
+    void resize(size_t capacity) {
+        entries.resize(capacity);
+    }
+
+    void add(size_t index, std::int16_t measurement) {
+        add_measurement(entries[index], measurement);
+    }
+
+    void combine(size_t index, const data_entry &against) {
+        merge_entry(entries[index], against);
+    }
+
+    void combine(std::span<const std::uint32_t> targets, std::span<const std::uint32_t> sources, const array_of_structs &other) {
+        for (size_t i = 0; i < targets.size(); i++) {
+            merge_entry(entries[targets[i]], other.entries[sources[i]]);
+        }
+    }
+
+    [[nodiscard]] data_entry get(size_t index) const {
+        return entries[index];
+    }
+
+    aligned_vector<data_entry> entries;
+};
+
+// Each field in its own array, so a merge streams four independent min, max
+// and add loops instead of walking whole entries.
+struct struct_of_arrays {
+    static constexpr auto name = "struct-of-arrays";
+
+    void resize(size_t capacity) {
+        sum.resize(capacity);
+        count.resize(capacity);
+        min.resize(capacity, std::numeric_limits<std::int16_t>::max());
+        max.resize(capacity, std::numeric_limits<std::int16_t>::min());
+    }
+
+    void add(size_t index, std::int16_t measurement) {
+        min[index] = measurement < min[index] ? measurement : min[index];
+        max[index] = measurement > max[index] ? measurement : max[index];
+        sum[index] += measurement;
+        count[index] += 1;
+    }
+
+    void combine(size_t index, const data_entry &against) {
+        min[index] = against.min < min[index] ? against.min : min[index];
+        max[index] = against.max > max[index] ? against.max : max[index];
+        sum[index] += against.sum;
+        count[index] += against.count;
+    }
+
+    void combine(std::span<const std::uint32_t> targets, std::span<const std::uint32_t> sources, const struct_of_arrays &other) {
+        for (size_t i = 0; i < targets.size(); i++) {
+            min[targets[i]] = std::min(min[targets[i]], other.min[sources[i]]);
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            max[targets[i]] = std::max(max[targets[i]], other.max[sources[i]]);
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            sum[targets[i]] += other.sum[sources[i]];
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            count[targets[i]] += other.count[sources[i]];
+        }
+    }
+
+    [[nodiscard]] data_entry get(size_t index) const {
+        return {.sum = sum[index], .count = count[index], .min = min[index], .max = max[index]};
+    }
+
+    aligned_vector<std::int64_t> sum;
+    aligned_vector<std::uint32_t> count;
+    aligned_vector<std::int16_t> min;
+    aligned_vector<std::int16_t> max;
+};
+
+struct aggregate_features {
+    bool variance = false;
+    std::vector<double> percentiles;
+    std::vector<double> quantiles;
+    double compression = 100.0;
+
+    [[nodiscard]] bool histogram() const { return !percentiles.empty(); }
+    [[nodiscard]] bool sketch() const { return !quantiles.empty(); }
+};
+
+// Exact distribution of one station over every representable value from
+// -99.9 to 99.9. Counters start at 8 bits and widen once the station's row
+// count could overflow them, so no bin ever needs its own overflow check.
+class tiered_histogram {
 public:
-    explicit buffered_batch_reader(const std::filesystem::path& path) : cursor(0) {
-        auto file = std::ifstream(path, std::ios::ate);
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
+    static constexpr auto lowest = -999;
+    static constexpr auto bins = size_t(1999);
 
-        buffer.resize(size, ' ');
-        file.read(buffer.data(), size);
+    void add(std::int16_t measurement, std::uint32_t occurrences = 1) {
+        const auto bin = static_cast<size_t>(std::clamp<int>(measurement, lowest, -lowest) - lowest);
+        widen_for(total + occurrences);
+        total += occurrences;
+        switch (width) {
+            case 1: narrow[bin] += static_cast<std::uint8_t>(occurrences); break;
+            case 2: medium[bin] += static_cast<std::uint16_t>(occurrences); break;
+            default: wide[bin] += occurrences; break;
+        }
     }
 
-    struct batch_read_result {
-        std::array<std::string, MaxBatchSize> lines = {};
-        size_t count = 0;
-    };
-    [[nodiscard]] batch_read_result next_batch() {
-        auto result = batch_read_result();
+    void merge(const tiered_histogram &other) {
+        widen_for(total + other.total);
+        total += other.total;
+        switch (width) {
+            case 1: add_counts(narrow, other); break;
+            case 2: add_counts(medium, other); break;
+            default: add_counts(wide, other); break;
+        }
+    }
 
-        while (result.count != MaxBatchSize && cursor < buffer.size()) {
-            auto start = buffer.begin() + cursor;
-            auto end = start;
-            size_t count = 1;
-            while (++count, *(++end) != '\n');
-            result.lines[result.count++] = {start, end};
-            cursor += count;
+    [[nodiscard]] std::uint32_t count(size_t bin) const {
+        switch (width) {
+            case 1: return narrow[bin];
+            case 2: return medium[bin];
+            default: return wide[bin];
         }
+    }
 
-        return result;
+    // Nearest-rank percentile, in tenths.
+    [[nodiscard]] std::int16_t percentile(double percent) const {
+        const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(total))));
+        auto seen = std::uint64_t(0);
+        for (size_t bin = 0; bin < bins; bin++) {
+            seen += count(bin);
+            if (seen >= rank) {
+                return static_cast<std::int16_t>(static_cast<int>(bin) + lowest);
+            }
+        }
+        return static_cast<std::int16_t>(-lowest);
     }
 
 private:
-    std::string buffer;
-    size_t cursor;
+    template <typename T>
+    void add_counts(aligned_vector<T> &into, const tiered_histogram &other) {
+        switch (other.width) {
+            case 1: for (size_t i = 0; i < bins; i++) into[i] += other.narrow[i]; break;
+            case 2: for (size_t i = 0; i < bins; i++) into[i] += static_cast<T>(other.medium[i]); break;
+            default: for (size_t i = 0; i < bins; i++) into[i] += static_cast<T>(other.wide[i]); break;
+        }
+    }
+
+    void widen_for(std::uint64_t rows) {
+        if (width == 1 && rows > std::numeric_limits<std::uint8_t>::max()) {
+            medium.assign(narrow.begin(), narrow.end());
+            narrow = {};
+            width = 2;
+        }
+        if (width == 2 && rows > std::numeric_limits<std::uint16_t>::max()) {
+            wide.assign(medium.begin(), medium.end());
+            medium = {};
+            width = 4;
+        }
+    }
+
+    std::uint64_t total = 0;
+    std::uint8_t width = 1;
+    aligned_vector<std::uint8_t> narrow = aligned_vector<std::uint8_t>(bins);
+    aligned_vector<std::uint16_t> medium;
+    aligned_vector<std::uint32_t> wide;
 };
 
-constexpr auto batch_size = 256;
-using reader = buffered_batch_reader<batch_size>;
-using batch_data = reader::batch_read_result;
+// Merging t-digest for values with no useful bound. Rows land in a small
+// buffer and are only sorted into centroids when it fills, so the per-row
+// cost is an append. Centroid sizes follow the k1 scale function, which
+// bounds memory by the compression and keeps the tails most accurate.
+class t_digest {
+public:
+    explicit t_digest(double compression = 100.0) : compression(compression) {}
 
-std::vector<std::thread> dispatch_threads(
-        moodycamel::ConcurrentQueue<batch_data> &queue,
-        std::vector<std::vector<data_entry>> &entries,
-        std::set<std::string> &names,
-        std::atomic<bool> &running) {
-    const auto thread_count = std::thread::hardware_concurrency() - 1;
+    void add(double value, double weight = 1.0) {
+        buffer.push_back({value, weight});
+        if (buffer.size() >= buffer_limit()) {
+            flush();
+        }
+    }
 
-    auto threads = std::vector<std::thread>();
+    void merge(const t_digest &other) {
+        buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+        buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+        flush();
+    }
 
-    for (size_t i = 0; i < thread_count; i++) {
-        threads.emplace_back([&, i](){
-            auto &data = entries[i];
-            data.resize(32'768);
+    [[nodiscard]] double quantile(double q) const {
+        if (!buffer.empty()) {
+            auto flushed = *this;
+            flushed.flush();
+            return flushed.quantile(q);
+        }
+        if (centroids.empty()) {
+            return 0.0;
+        }
+        if (centroids.size() == 1) {
+            return centroids.front().mean;
+        }
 
-            while (running) {
-                auto batch_result = batch_data();
-                if (queue.try_dequeue(batch_result)) {
-                    process_batch(
-                            {batch_result.lines.begin(), batch_result.lines.begin() + batch_result.count},
-                            data, [&, i](std::string_view name){
-                               if (i == 0 && names.size() != 413) {
-                                   names.insert(std::string(name));
-                               }
-                            });
-                }
+        const auto target = std::clamp(q, 0.0, 1.0) * total;
+        auto cumulative = 0.0;
+        auto previous_center = 0.0;
+        auto previous_mean = lowest;
+        for (const auto &current : centroids) {
+            const auto center = cumulative + current.weight / 2.0;
+            if (target < center) {
+                const auto fraction = center == previous_center ? 0.0 : (target - previous_center) / (center - previous_center);
+                return previous_mean + fraction * (current.mean - previous_mean);
             }
-        });
+            cumulative += current.weight;
+            previous_center = center;
+            previous_mean = current.mean;
+        }
+        const auto fraction = total == previous_center ? 1.0 : (target - previous_center) / (total - previous_center);
+        return previous_mean + fraction * (highest - previous_mean);
     }
 
-    return threads;
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+        std::ranges::sort(buffer, {}, &centroid::mean);
+        lowest = std::min(lowest, buffer.front().mean);
+        highest = std::max(highest, buffer.back().mean);
+        total = 0.0;
+        for (const auto &point : buffer) {
+            total += point.weight;
+        }
+
+        centroids.clear();
+        auto current = buffer.front();
+        auto consumed = 0.0;
+        auto limit = limit_after(0.0);
+        for (size_t i = 1; i < buffer.size(); i++) {
+            const auto &point = buffer[i];
+            if ((consumed + current.weight + point.weight) / total <= limit) {
+                current.mean += (point.mean - current.mean) * point.weight / (current.weight + point.weight);
+                current.weight += point.weight;
+            } else {
+                consumed += current.weight;
+                centroids.push_back(current);
+                limit = limit_after(consumed / total);
+                current = point;
+            }
+        }
+        centroids.push_back(current);
+        buffer.clear();
+    }
+
+private:
+    struct centroid {
+        double mean = 0.0;
+        double weight = 0.0;
+    };
+
+    [[nodiscard]] size_t buffer_limit() const {
+        return static_cast<size_t>(compression) * 2;
+    }
+
+    // q at which the next centroid must close: k^-1(k(q) + 1) for
+    // k(q) = compression / (2 pi) * asin(2q - 1).
+    [[nodiscard]] double limit_after(double q) const {
+        constexpr auto pi = 3.14159265358979323846;
+        const auto k = compression / (2.0 * pi) * std::asin(std::clamp(2.0 * q - 1.0, -1.0, 1.0)) + 1.0;
+        const auto angle = std::min(2.0 * pi * k / compression, pi / 2.0);
+        return (std::sin(angle) + 1.0) / 2.0;
+    }
+
+    double compression;
+    double total = 0.0;
+    double lowest = std::numeric_limits<double>::infinity();
+    double highest = -std::numeric_limits<double>::infinity();
+    std::vector<centroid> centroids;
+    std::vector<centroid> buffer;
+};
+
+// Optional per-station statistics kept beside the core aggregates. Arrays of
+// features that are switched off stay empty, so they cost the hot loop one
+// predictable branch each.
+class extra_aggregates {
+public:
+    extra_aggregates() = default;
+
+    extra_aggregates(size_t capacity, aggregate_features features) : features(features) {
+        if (features.variance) {
+            sum_of_squares.resize(capacity);
+        }
+        if (features.histogram()) {
+            histograms.resize(capacity);
+        }
+        if (features.sketch()) {
+            digests.resize(capacity);
+        }
+    }
+
+    void add(size_t index, std::int16_t measurement) {
+        if (features.variance) {
+            sum_of_squares[index] += static_cast<std::int64_t>(measurement) * measurement;
+        }
+        if (features.histogram()) {
+            histogram_at(index).add(measurement);
+        }
+        if (features.sketch()) {
+            digest_at(index).add(measurement);
+        }
+    }
+
+    void combine(size_t index, const extra_aggregates &other, size_t other_index) {
+        if (features.variance) {
+            sum_of_squares[index] += other.sum_of_squares[other_index];
+        }
+        if (features.histogram() && other.histograms[other_index]) {
+            histogram_at(index).merge(*other.histograms[other_index]);
+        }
+        if (features.sketch() && other.digests[other_index]) {
+            digest_at(index).merge(*other.digests[other_index]);
+        }
+    }
+
+    void combine_squares(size_t index, std::int64_t squares) {
+        if (features.variance) {
+            sum_of_squares[index] += squares;
+        }
+    }
+
+    void combine_histogram(size_t index, const tiered_histogram &against) {
+        if (features.histogram()) {
+            histogram_at(index).merge(against);
+        }
+    }
+
+    void combine_digest(size_t index, const t_digest &against) {
+        if (features.sketch()) {
+            digest_at(index).merge(against);
+        }
+    }
+
+    [[nodiscard]] std::int64_t squares(size_t index) const { return sum_of_squares[index]; }
+    [[nodiscard]] const tiered_histogram &histogram(size_t index) const { return *histograms[index]; }
+    [[nodiscard]] const t_digest &digest(size_t index) const { return *digests[index]; }
+    [[nodiscard]] const aggregate_features &enabled() const { return features; }
+
+private:
+    [[nodiscard]] tiered_histogram &histogram_at(size_t index) {
+        auto &histogram = histograms[index];
+        if (!histogram) {
+            histogram = std::make_unique<tiered_histogram>();
+        }
+        return *histogram;
+    }
+
+    [[nodiscard]] t_digest &digest_at(size_t index) {
+        auto &digest = digests[index];
+        if (!digest) {
+            digest = std::make_unique<t_digest>(features.compression);
+        }
+        return *digest;
+    }
+
+    aggregate_features features;
+    aligned_vector<std::int64_t> sum_of_squares;
+    std::vector<std::unique_ptr<tiered_histogram>> histograms;
+    std::vector<std::unique_ptr<t_digest>> digests;
+};
+
+// Population variance in degrees squared. Moments are exact integers in
+// tenths, so they merge across threads by plain addition (Chan's combine with
+// no rounding), and centring on the rounded mean before converting to double
+// avoids the cancellation of the textbook sum-of-squares formula.
+[[nodiscard]] double variance(const data_entry &entry, std::int64_t sum_of_squares) {
+    const auto count = static_cast<std::int64_t>(entry.count);
+    const auto pivot = entry.sum / count;
+    const auto centred_squares = sum_of_squares - 2 * pivot * entry.sum + count * pivot * pivot;
+    const auto offset = static_cast<double>(entry.sum - count * pivot) / static_cast<double>(count);
+    return (static_cast<double>(centred_squares) / static_cast<double>(count) - offset * offset) / 100.0;
 }
 
-int main() {
-    auto data = std::vector<data_entry>(32'768);
-    auto entries = std::vector<std::vector<data_entry>>(std::thread::hardware_concurrency() - 1);
-    auto names = std::set<std::string>();
+// Open addressing table keyed by station name. Each slot owns its key, so a
+// table can be merged into another and printed without any outside record of
+// which stations were seen. Storage decides how the aggregates are laid out.
+// Occupied slots are also listed in insertion order, so merging and output
+// cost scales with the stations seen rather than with the capacity.
+// The table object itself fills whole cache lines so neighbouring tables in
+// a vector do not false-share their bookkeeping.
+template <typename Hash, typename Storage = array_of_structs>
+class alignas(cache_line_size) aggregation_table {
+public:
+    using hash_type = Hash;
+
+    struct key {
+        std::uint64_t hash = 0;
+        std::string name;
+    };
+    static constexpr auto bytes_per_slot = sizeof(key) + sizeof(data_entry);
 
-    auto queue = moodycamel::ConcurrentQueue<batch_data>();
+    aggregation_table() = default;
 
-    auto running = std::atomic<bool>(true);
+    explicit aggregation_table(size_t capacity, aggregate_features features = {}) : keys(std::bit_ceil(std::max<size_t>(capacity, 16))) {
+        values.resize(keys.size());
+        extras = extra_aggregates(keys.size(), features);
+        shift = 64 - std::countr_zero(keys.size());
+    }
 
-    auto producer_thread = std::thread([&](){
-        auto reader = buffered_batch_reader<batch_size>("measurements_large.txt");
+    [[nodiscard]] size_t find_or_insert(std::string_view name) {
+        return find_or_insert(name, Hash::hash(name));
+    }
+
+    [[nodiscard]] size_t find_or_insert(std::string_view name, std::uint64_t hash) {
+        auto index = slot_index(hash);
         while (true) {
-            auto batch_result = reader.next_batch();
-            if (batch_result.count == 0) {
-                break;
+            auto &candidate = keys[index];
+            if (candidate.name.empty()) {
+                if ((occupied.size() + 1) * 4 > keys.size() * 3) {
+                    grow();
+                    return find_or_insert(name, hash);
+                }
+                candidate.hash = hash;
+                candidate.name = name;
+                occupied.push_back(static_cast<std::uint32_t>(index));
+                return index;
             }
-            queue.enqueue(batch_result);
+            if (candidate.hash == hash && candidate.name == name) {
+                return index;
+            }
+            index = (index + 1) & (keys.size() - 1);
         }
-        running = false;
-    });
+    }
 
-    for (auto &thread : dispatch_threads(queue, entries, names, running)) {
-        thread.join();
+    [[nodiscard]] static std::uint64_t hash(std::string_view name) {
+        return Hash::hash(name);
     }
-    producer_thread.join();
 
-    for (size_t i = 0; i < data.size(); i++) {
-        auto &result = data[i];
-        for (const auto &entry : entries) {
-            auto &against = entry[i];
-            result.min = against.min < result.min ? against.min : result.min;
-            result.max = against.max > result.max ? against.max : result.max;
-            result.sum += against.sum;
-            result.count += against.count;
+    void add(std::string_view name, std::int16_t measurement) {
+        add(name, Hash::hash(name), measurement);
+    }
+
+    void add(std::string_view name, std::uint64_t hash, std::int16_t measurement) {
+        const auto index = find_or_insert(name, hash);
+        values.add(index, measurement);
+        extras.add(index, measurement);
+    }
+
+    size_t combine(std::string_view name, std::uint64_t hash, const data_entry &against) {
+        const auto index = find_or_insert(name, hash);
+        values.combine(index, against);
+        return index;
+    }
+
+    // Tables are not slot-aligned, so keys are resolved first and the
+    // aggregates are then combined in one pass over the resolved pairs.
+    void merge(const aggregation_table &other) {
+        auto targets = std::vector<std::uint32_t>();
+        targets.reserve(other.occupied.size());
+        for (const auto source : other.occupied) {
+            targets.push_back(static_cast<std::uint32_t>(find_or_insert(other.keys[source].name, other.keys[source].hash)));
+        }
+        values.combine(targets, other.occupied, other.values);
+        for (size_t i = 0; i < targets.size(); i++) {
+            extras.combine(targets[i], other.extras, other.occupied[i]);
+        }
+    }
+
+    [[nodiscard]] std::span<const std::uint32_t> slots() const { return occupied; }
+
+    [[nodiscard]] std::vector<size_t> sorted_slots() const {
+        auto result = std::vector<size_t>(occupied.begin(), occupied.end());
+        std::ranges::sort(result, {}, [&](size_t index) -> const std::string & { return keys[index].name; });
+        return result;
+    }
+
+    [[nodiscard]] const std::string &name(size_t index) const { return keys[index].name; }
+    [[nodiscard]] data_entry entry(size_t index) const { return values.get(index); }
+    [[nodiscard]] const extra_aggregates &extra() const { return extras; }
+    [[nodiscard]] extra_aggregates &extra() { return extras; }
+
+    struct probe_statistics {
+        size_t home_collisions = 0;
+        size_t hash_collisions = 0;
+        size_t max_probe = 0;
+        double average_probe = 0.0;
+    };
+    [[nodiscard]] probe_statistics probes() const {
+        auto result = probe_statistics();
+        auto homes = std::vector<std::uint64_t>();
+        auto hashes = std::vector<std::uint64_t>();
+        auto total = size_t(0);
+        for (const auto i : occupied) {
+            const auto home = slot_index(keys[i].hash);
+            const auto distance = (i - home) & (keys.size() - 1);
+            total += distance;
+            result.max_probe = std::max(result.max_probe, distance);
+            homes.push_back(home);
+            hashes.push_back(keys[i].hash);
+        }
+        std::ranges::sort(homes);
+        std::ranges::sort(hashes);
+        result.home_collisions = homes.size() - std::ranges::distance(homes.begin(), std::ranges::unique(homes).begin());
+        result.hash_collisions = hashes.size() - std::ranges::distance(hashes.begin(), std::ranges::unique(hashes).begin());
+        result.average_probe = occupied.empty() ? 0.0 : static_cast<double>(total) / static_cast<double>(occupied.size());
+        return result;
+    }
+
+    [[nodiscard]] size_t size() const { return occupied.size(); }
+    [[nodiscard]] size_t capacity() const { return keys.size(); }
+
+private:
+    [[nodiscard]] size_t slot_index(std::uint64_t hash) const {
+        return (hash * 336043159889533) >> shift;
+    }
+
+    void grow() {
+        auto previous_keys = std::exchange(keys, aligned_vector<key>(keys.size() * 2));
+        auto previous_values = std::exchange(values, Storage());
+        values.resize(keys.size());
+        auto previous_extras = std::exchange(extras, extra_aggregates(keys.size(), extras.enabled()));
+        shift--;
+        for (auto &slot : occupied) {
+            auto index = slot_index(previous_keys[slot].hash);
+            while (!keys[index].name.empty()) {
+                index = (index + 1) & (keys.size() - 1);
+            }
+            keys[index] = std::move(previous_keys[slot]);
+            values.combine(index, previous_values.get(slot));
+            extras.combine(index, previous_extras, slot);
+            slot = static_cast<std::uint32_t>(index);
+        }
+    }
+
+    aligned_vector<key> keys;
+    Storage values;
+    extra_aggregates extras;
+    std::vector<std::uint32_t> occupied;
+    int shift = 64;
+};
+
+template <typename T>
+void atomic_min(std::atomic<T> &target, T value) {
+    auto current = target.load(std::memory_order_relaxed);
+    while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+template <typename T>
+void atomic_max(std::atomic<T> &target, T value) {
+    auto current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+// Single table shared by every worker. Slots are claimed with a CAS on their
+// state and never move, so the capacity is fixed up front and the hot path
+// only touches the atomics of the station being updated.
+template <typename Hash>
+class concurrent_aggregation_table {
+public:
+    using hash_type = Hash;
+
+    explicit concurrent_aggregation_table(size_t capacity, aggregate_features features = {}) : slots(std::bit_ceil(std::max<size_t>(capacity, 16))), occupied(slots.size()), features(features) {
+        shift = 64 - std::countr_zero(slots.size());
+    }
+
+    [[nodiscard]] static std::uint64_t hash(std::string_view name) {
+        return Hash::hash(name);
+    }
+
+    void add(std::string_view name, std::int16_t measurement) {
+        add(name, Hash::hash(name), measurement);
+    }
+
+    // Rows that find no free slot are dropped and the table is marked
+    // overflowed; see overflowed().
+    void add(std::string_view name, std::uint64_t hash, std::int16_t measurement) {
+        auto *const entry = update(name, hash, measurement);
+        if (entry != nullptr && features.sketch()) {
+            const auto lock = std::lock_guard(entry->digest_mutex);
+            entry->digest->add(measurement);
+        }
+    }
+
+private:
+    struct slot;
+
+public:
+    // A worker's handle on the table. Sketch values are buffered per slot
+    // and folded into the slot's digest under its lock a batch at a time,
+    // so the lock is not taken per row. Flush before merging.
+    class writer {
+    public:
+        using hash_type = Hash;
+        static constexpr auto batch_values = size_t(128);
+
+        explicit writer(concurrent_aggregation_table &table) : table(&table) {
+            if (table.features.sketch()) {
+                pending.resize(table.slots.size());
+            }
+        }
+
+        [[nodiscard]] static std::uint64_t hash(std::string_view name) {
+            return Hash::hash(name);
+        }
+
+        void add(std::string_view name, std::int16_t measurement) {
+            add(name, Hash::hash(name), measurement);
+        }
+
+        void add(std::string_view name, std::uint64_t hash, std::int16_t measurement) {
+            auto *const entry = table->update(name, hash, measurement);
+            if (entry == nullptr || pending.empty()) {
+                return;
+            }
+            auto &values = pending[size_t(entry - table->slots.data())];
+            values.push_back(measurement);
+            if (values.size() == batch_values) {
+                fold(*entry, values);
+            }
+        }
+
+        void flush() {
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (!pending[i].empty()) {
+                    fold(table->slots[i], pending[i]);
+                }
+            }
+        }
+
+    private:
+        static void fold(slot &entry, std::vector<std::int16_t> &values) {
+            const auto lock = std::lock_guard(entry.digest_mutex);
+            for (const auto value : values) {
+                entry.digest->add(value);
+            }
+            values.clear();
+        }
+
+        concurrent_aggregation_table *table;
+        std::vector<std::vector<std::int16_t>> pending;
+    };
+
+    // Only valid once every writer has finished.
+    template <typename Table>
+    void merge_into(Table &result) const {
+        for (size_t i = 0; i < used.load(std::memory_order_acquire); i++) {
+            const auto &candidate = slots[occupied[i]];
+            const auto index = result.combine(candidate.name, candidate.hash, data_entry {
+                .sum = candidate.sum.load(std::memory_order_relaxed),
+                .count = candidate.count.load(std::memory_order_relaxed),
+                .min = candidate.min.load(std::memory_order_relaxed),
+                .max = candidate.max.load(std::memory_order_relaxed),
+            });
+            result.extra().combine_squares(index, candidate.sum_of_squares.load(std::memory_order_relaxed));
+            if (candidate.histogram) {
+                auto histogram = tiered_histogram();
+                for (size_t bin = 0; bin < tiered_histogram::bins; bin++) {
+                    const auto occurrences = candidate.histogram[bin].load(std::memory_order_relaxed);
+                    if (occurrences != 0) {
+                        histogram.add(static_cast<std::int16_t>(static_cast<int>(bin) + tiered_histogram::lowest), occurrences);
+                    }
+                }
+                result.extra().combine_histogram(index, histogram);
+            }
+            if (candidate.digest) {
+                result.extra().combine_digest(index, *candidate.digest);
+            }
         }
     }
 
-    output_batch(names, data);
+    [[nodiscard]] size_t capacity() const { return slots.size(); }
+
+    // True once a station found the table full. The contents are then
+    // incomplete, and the caller has to redo the work with per-thread
+    // tables, which grow.
+    [[nodiscard]] bool overflowed() const { return full.load(std::memory_order_acquire); }
 
-    return 0;
+private:
+    enum class slot_state : std::uint32_t {
+        empty,
+        writing,
+        ready,
+    };
+
+    struct alignas(cache_line_size) slot {
+        std::atomic<slot_state> state = slot_state::empty;
+        std::uint64_t hash = 0;
+        std::string name;
+        std::atomic<std::int64_t> sum = 0;
+        std::atomic<std::uint32_t> count = 0;
+        std::atomic<std::int16_t> min = std::numeric_limits<std::int16_t>::max();
+        std::atomic<std::int16_t> max = std::numeric_limits<std::int16_t>::min();
+        std::atomic<std::int64_t> sum_of_squares = 0;
+        std::unique_ptr<std::atomic<std::uint32_t>[]> histogram;
+        std::mutex digest_mutex;
+        std::unique_ptr<t_digest> digest;
+    };
+
+    // Everything but the sketch, which the callers fold in themselves.
+    [[nodiscard]] slot *update(std::string_view name, std::uint64_t hash, std::int16_t measurement) {
+        if (full.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        auto *const slot = find_or_insert(name, hash);
+        if (slot == nullptr) {
+            return nullptr;
+        }
+        auto &entry = *slot;
+        atomic_min(entry.min, measurement);
+        atomic_max(entry.max, measurement);
+        entry.sum.fetch_add(measurement, std::memory_order_relaxed);
+        entry.count.fetch_add(1, std::memory_order_relaxed);
+        if (features.variance) {
+            entry.sum_of_squares.fetch_add(static_cast<std::int64_t>(measurement) * measurement, std::memory_order_relaxed);
+        }
+        if (features.histogram()) {
+            const auto bin = std::clamp<int>(measurement, tiered_histogram::lowest, -tiered_histogram::lowest) - tiered_histogram::lowest;
+            entry.histogram[bin].fetch_add(1, std::memory_order_relaxed);
+        }
+        return slot;
+    }
+
+    [[nodiscard]] slot *find_or_insert(std::string_view name, std::uint64_t hash) {
+        auto index = static_cast<size_t>((hash * 336043159889533) >> shift);
+        while (true) {
+            auto &candidate = slots[index];
+            auto state = candidate.state.load(std::memory_order_acquire);
+            if (state == slot_state::empty && candidate.state.compare_exchange_strong(state, slot_state::writing, std::memory_order_acquire)) {
+                const auto position = used.fetch_add(1, std::memory_order_relaxed);
+                if (position + 1 >= slots.size()) {
+                    // Hand the slot back so nobody waits on it forever.
+                    full.store(true, std::memory_order_release);
+                    candidate.state.store(slot_state::empty, std::memory_order_release);
+                    return nullptr;
+                }
+                occupied[position] = static_cast<std::uint32_t>(index);
+                candidate.hash = hash;
+                candidate.name = name;
+                if (features.histogram()) {
+                    candidate.histogram = std::make_unique<std::atomic<std::uint32_t>[]>(tiered_histogram::bins);
+                }
+                if (features.sketch()) {
+                    candidate.digest = std::make_unique<t_digest>(features.compression);
+                }
+                candidate.state.store(slot_state::ready, std::memory_order_release);
+                return &candidate;
+            }
+            while (state == slot_state::writing) {
+                state = candidate.state.load(std::memory_order_acquire);
+            }
+            if (state == slot_state::empty) {
+                if (full.load(std::memory_order_acquire)) {
+                    return nullptr;
+                }
+                continue;
+            }
+            if (candidate.hash == hash && candidate.name == name) {
+                return &candidate;
+            }
+            index = (index + 1) & (slots.size() - 1);
+        }
+    }
+
+    std::vector<slot> slots;
+    std::vector<std::uint32_t> occupied;
+    std::atomic<size_t> used = 0;
+    std::atomic<bool> full = false;
+    aggregate_features features;
+    int shift = 64;
+};
+
+using station_table = aggregation_table<station_hash>;
+using shared_station_table = concurrent_aggregation_table<station_hash>;
+
+void print_tenths(std::ostream &stream, std::int64_t tenths) {
+    if (tenths < 0) {
+        stream << '-';
+        tenths = -tenths;
+    }
+    stream << tenths / 10 << '.' << tenths % 10;
+}
+
+// Mean in tenths, rounded half up like the reference implementation.
+[[nodiscard]] std::int64_t mean_tenths(const data_entry &entry) {
+    const auto numerator = 2 * entry.sum + entry.count;
+    const auto denominator = 2 * static_cast<std::int64_t>(entry.count);
+    return numerator / denominator - (numerator % denominator < 0 ? 1 : 0);
+}
+
+template <typename Table>
+void output_batch(const Table &data, std::span<const size_t> stations) {
+    std::cout << '{';
+    std::cout << std::fixed << std::setprecision(2);
+
+    auto it = stations.begin();
+    while (it != stations.end()) {
+        const auto entry = data.entry(*it);
+        std::cout << data.name(*it) << '=';
+        print_tenths(std::cout, entry.min);
+        std::cout << '/';
+        print_tenths(std::cout, mean_tenths(entry));
+        std::cout << '/';
+        print_tenths(std::cout, entry.max);
+        if (data.extra().enabled().variance) {
+            const auto station_variance = variance(entry, data.extra().squares(*it));
+            std::cout << '/' << std::sqrt(station_variance) << '/' << station_variance;
+        }
+        for (const auto percent : data.extra().enabled().percentiles) {
+            std::cout << '/';
+            print_tenths(std::cout, data.extra().histogram(*it).percentile(percent));
+        }
+        for (const auto q : data.extra().enabled().quantiles) {
+            std::cout << '/';
+            print_tenths(std::cout, std::llround(data.extra().digest(*it).quantile(q)));
+        }
+        if (++it != stations.end()) {
+            std::cout << ", ";
+        }
+    }
+    std::cout << '}';
+}
+
+enum class station_column {
+    min,
+    mean,
+    max,
+    count,
+    stddev,
+};
+
+struct ranking_query {
+    size_t k = 0;
+    station_column column = station_column::mean;
+    bool highest = true;
+};
+
+// The k best stations by one column, best first, ties broken by name.
+// nth_element keeps this O(stations + k log k) instead of a full sort.
+template <typename Table>
+[[nodiscard]] std::vector<size_t> ranked_slots(const Table &data, const ranking_query &query) {
+    auto ranked = std::vector<std::pair<double, size_t>>();
+    ranked.reserve(data.size());
+    for (const auto index : data.slots()) {
+        const auto entry = data.entry(index);
+        auto value = 0.0;
+        switch (query.column) {
+            case station_column::min: value = entry.min; break;
+            case station_column::mean: value = static_cast<double>(entry.sum) / entry.count; break;
+            case station_column::max: value = entry.max; break;
+            case station_column::count: value = entry.count; break;
+            case station_column::stddev: value = variance(entry, data.extra().squares(index)); break;
+        }
+        ranked.emplace_back(query.highest ? -value : value, index);
+    }
+
+    const auto before = [&](const std::pair<double, size_t> &a, const std::pair<double, size_t> &b) {
+        return a.first != b.first ? a.first < b.first : data.name(a.second) < data.name(b.second);
+    };
+    const auto k = std::min(query.k, ranked.size());
+    std::nth_element(ranked.begin(), ranked.begin() + static_cast<std::ptrdiff_t>(k), ranked.end(), before);
+    ranked.resize(k);
+    std::ranges::sort(ranked, before);
+
+    auto result = std::vector<size_t>();
+    for (const auto &[value, index] : ranked) {
+        result.push_back(index);
+    }
+    return result;
+}
+
+[[nodiscard]] std::uint64_t mix_bits(std::uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    return hash ^ (hash >> 33);
+}
+
+// Which stations a query wants: exact names, name prefixes and a regular
+// expression, any of which admits a station. No conditions admits all.
+struct station_filter {
+    std::vector<std::string> names;
+    std::vector<std::string> prefixes;
+    std::optional<std::regex> pattern;
+
+    [[nodiscard]] bool active() const {
+        return !names.empty() || !prefixes.empty() || pattern;
+    }
+
+    [[nodiscard]] bool exact_only() const {
+        return prefixes.empty() && !pattern;
+    }
+
+    [[nodiscard]] bool matches(std::string_view name) const {
+        return std::ranges::binary_search(names, name, std::less<>())
+               || std::ranges::any_of(prefixes, [&](const std::string &prefix) { return name.starts_with(prefix); })
+               || (pattern && std::regex_search(name.begin(), name.end(), *pattern));
+    }
+};
+
+// Per-worker view of a station_filter, run right after the name is hashed.
+// Accept or reject per distinct station, found by the row's hash and
+// confirmed by name. Linear probing; doubles at half full.
+class verdict_cache {
+public:
+    // The cached verdict, or decide()'s for a station not seen before.
+    template <typename Decide>
+    [[nodiscard]] bool find_or_decide(std::string_view name, std::uint64_t hash, Decide &&decide) {
+        auto index = probe_start(hash);
+        while (slots[index].known) {
+            if (slots[index].hash == hash && slots[index].name == name) {
+                return slots[index].accepted;
+            }
+            index = (index + 1) & (slots.size() - 1);
+        }
+        const auto accepted = decide();
+        slots[index] = {hash, std::string(name), true, accepted};
+        if (++used * 2 > slots.size()) {
+            grow();
+        }
+        return accepted;
+    }
+
+private:
+    struct slot {
+        std::uint64_t hash = 0;
+        std::string name;
+        bool known = false;
+        bool accepted = false;
+    };
+
+    [[nodiscard]] size_t probe_start(std::uint64_t hash) const {
+        return static_cast<size_t>(mix_bits(hash)) & (slots.size() - 1);
+    }
+
+    void grow() {
+        auto old = std::exchange(slots, std::vector<slot>(slots.size() * 2));
+        for (auto &entry : old) {
+            if (entry.known) {
+                auto index = probe_start(entry.hash);
+                while (slots[index].known) {
+                    index = (index + 1) & (slots.size() - 1);
+                }
+                slots[index] = std::move(entry);
+            }
+        }
+    }
+
+    std::vector<slot> slots = std::vector<slot>(64);
+    size_t used = 0;
+};
+
+// Exact-name filters reject most rows with a Bloom filter probe; prefix and
+// regex filters evaluate each distinct station once and then hit a cache
+// of verdicts. Only built for an active filter; see with_matcher.
+template <typename Hash>
+class station_matcher {
+public:
+    explicit station_matcher(const station_filter &filter) : filter(filter) {
+        bloom.resize(std::bit_ceil(std::max<size_t>(filter.names.size() * 16, 64)) / 64);
+        for (const auto &name : filter.names) {
+            const auto mixed = mix_bits(Hash::hash(name));
+            for (size_t i = 0; i < bloom_probes; i++) {
+                const auto bit = bloom_bit(mixed, i);
+                bloom[bit / 64] |= std::uint64_t(1) << (bit % 64);
+            }
+        }
+    }
+
+    [[nodiscard]] bool accepts(std::string_view name, std::uint64_t hash) {
+        if (filter.exact_only()) {
+            const auto mixed = mix_bits(hash);
+            for (size_t i = 0; i < bloom_probes; i++) {
+                const auto bit = bloom_bit(mixed, i);
+                if ((bloom[bit / 64] & (std::uint64_t(1) << (bit % 64))) == 0) {
+                    return false;
+                }
+            }
+            return std::ranges::binary_search(filter.names, name, std::less<>());
+        }
+
+        return verdicts.find_or_decide(name, hash, [&]() { return filter.matches(name); });
+    }
+
+private:
+    static constexpr auto bloom_probes = size_t(4);
+
+    [[nodiscard]] size_t bloom_bit(std::uint64_t mixed, size_t probe) const {
+        return static_cast<size_t>(((mixed >> 32) + probe * (mixed | 1)) & (bloom.size() * 64 - 1));
+    }
+
+    const station_filter &filter;
+    std::vector<std::uint64_t> bloom;
+    verdict_cache verdicts;
+};
+
+struct accept_all {
+    [[nodiscard]] static constexpr bool accepts(std::string_view, std::uint64_t) { return true; }
+};
+
+// Runs body with what rows are checked against: a station_matcher when the
+// filter is active, otherwise accept_all, so unfiltered runs instantiate
+// process_row without any check.
+template <typename Hash, typename Body>
+void with_matcher(const station_filter &filter, Body &&body) {
+    if (filter.active()) {
+        auto matcher = station_matcher<Hash>(filter);
+        body(matcher);
+    } else {
+        auto matcher = accept_all();
+        body(matcher);
+    }
+}
+
+// The classic grouping: everything before the value is the station.
+struct station_key {};
+
+// GROUP BY over something other than the station alone. Fields are the
+// ';'-separated columns before the value, the station being column 0.
+struct group_key {
+    enum class kind {
+        columns,
+        prefix,
+        region,
+    };
+
+    kind by = kind::columns;
+    std::vector<size_t> columns;
+    size_t prefix_length = 0;
+    std::shared_ptr<const std::unordered_map<std::string, std::string>> regions;
+};
+
+// Per-worker key derivation. Columns 0..n are a contiguous slice of the line
+// and are used in place; any other column set is assembled into a reused
+// scratch buffer, so no row allocates. Region lookups return views into the
+// mapping itself.
+class key_extractor {
+public:
+    explicit key_extractor(const group_key &spec) : spec(spec) {
+        if (spec.regions) {
+            for (const auto &[station, region] : *spec.regions) {
+                region_of.emplace(station, region);
+            }
+        }
+        contiguous = std::ranges::equal(spec.columns, std::views::iota(size_t(0), spec.columns.size()));
+    }
+
+    [[nodiscard]] static std::string_view station(std::string_view fields) {
+        return fields.substr(0, fields.find(';'));
+    }
+
+    [[nodiscard]] std::string_view key(std::string_view fields) {
+        switch (spec.by) {
+            case group_key::kind::prefix:
+                return station(fields).substr(0, spec.prefix_length);
+            case group_key::kind::region: {
+                const auto region = region_of.find(station(fields));
+                return region == region_of.end() ? std::string_view("(unmapped)") : region->second;
+            }
+            case group_key::kind::columns:
+                break;
+        }
+
+        if (contiguous) {
+            auto end = size_t(0);
+            for (size_t column = 0; column < spec.columns.size() && end != std::string_view::npos; column++) {
+                end = fields.find(';', column == 0 ? 0 : end + 1);
+            }
+            return fields.substr(0, end);
+        }
+
+        scratch.clear();
+        for (const auto wanted : spec.columns) {
+            auto start = size_t(0);
+            for (size_t column = 0; column < wanted && start != std::string_view::npos; column++) {
+                start = fields.find(';', start);
+                start = start == std::string_view::npos ? start : start + 1;
+            }
+            if (!scratch.empty()) {
+                scratch += ';';
+            }
+            if (start != std::string_view::npos) {
+                scratch += fields.substr(start, fields.find(';', start) - start);
+            }
+        }
+        return scratch;
+    }
+
+private:
+    const group_key &spec;
+    std::unordered_map<std::string_view, std::string_view> region_of;
+    std::string scratch;
+    bool contiguous = false;
+};
+
+// Epoch seconds are plain decimal integers, so skip strtoll's locale and
+// error handling.
+[[nodiscard]] constexpr std::int64_t parse_epoch(std::string_view text) {
+    const auto negative = !text.empty() && text.front() == '-';
+    auto value = std::int64_t(0);
+    for (const auto c : text.substr(negative)) {
+        value = value * 10 + (c - '0');
+    }
+    return negative ? -value : value;
+}
+
+// Floors rather than truncates so pre-epoch rows land in their own window.
+[[nodiscard]] constexpr std::int64_t window_start(std::int64_t timestamp, std::int64_t width) {
+    return (timestamp / width - (timestamp % width < 0)) * width;
+}
+
+// A "station;ts;temp" row split in place.
+struct timestamped_row {
+    std::string_view station;
+    std::int64_t timestamp;
+    std::string_view value;
+};
+
+[[nodiscard]] inline timestamped_row split_timestamped(std::string_view line) {
+    const auto value = line.rfind(';');
+    const auto timestamp = line.rfind(';', value - 1);
+    return {
+        line.substr(0, timestamp),
+        parse_epoch(line.substr(timestamp + 1, value - timestamp - 1)),
+        line.substr(value + 1),
+    };
+}
+
+// Rows the filter rejects skip value parsing and the table update. The
+// filter always sees the station; Key decides what the row is grouped by.
+template <typename Table, typename Filter, typename Key>
+inline void process_row(std::string_view line, Table &data, Filter &filter, Key &key) {
+    auto semicolon = size_t(line.size());
+    while (line[--semicolon] != ';');
+    const auto fields = std::string_view(line.data(), semicolon);
+    if constexpr (std::is_same_v<std::remove_cvref_t<Key>, station_key>) {
+        const auto hash = Table::hash(fields);
+        if (!filter.accepts(fields, hash)) {
+            return;
+        }
+        data.add(fields, hash, parse_tenths({line.begin() + semicolon + 1, line.end()}));
+    } else {
+        const auto station = key.station(fields);
+        if (!filter.accepts(station, Table::hash(station))) {
+            return;
+        }
+        const auto group = key.key(fields);
+        data.add(group, Table::hash(group), parse_tenths({line.begin() + semicolon + 1, line.end()}));
+    }
+}
+
+template <typename Table, typename Filter = accept_all, typename Key = station_key>
+void process_batch(std::span<const std::string> lines, Table &data, Filter &&filter = {}, Key &&key = {}) {
+    for (const auto &line : lines) {
+        process_row(line, data, filter, key);
+    }
+}
+
+// Non-empty lines of a buffer. The last one may lack its newline.
+template <typename Body>
+void for_each_line(std::string_view text, Body &&body) {
+    while (!text.empty()) {
+        const auto end = std::min(text.find('\n'), text.size());
+        if (end != 0) {
+            body(text.substr(0, end));
+        }
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+}
+
+// Rows straight out of the input buffer.
+template <typename Table, typename Filter = accept_all, typename Key = station_key>
+void process_batch(std::string_view text, Table &data, Filter &&filter = {}, Key &&key = {}) {
+    for_each_line(text, [&](std::string_view line) {
+        process_row(line, data, filter, key);
+    });
+}
+
+// The whole input as one read-only buffer. On Linux it is mapped, so
+// nothing is read up front: each worker faults in the pages of the ranges
+// it scans, in parallel, and only what is being scanned needs to be
+// resident. Elsewhere the file is read into a buffer that is not filled
+// first.
+class mapped_file {
+public:
+    explicit mapped_file(const std::filesystem::path &path) : size(size_t(std::filesystem::file_size(path))) {
+#if defined(__linux__)
+        const auto descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error("cannot open " + path.string());
+        }
+        if (size > 0) {
+            data = static_cast<char *>(::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0));
+        }
+        ::close(descriptor);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + path.string());
+        }
+#else
+        buffer = std::make_unique_for_overwrite<char[]>(size);
+        auto file = std::ifstream(path, std::ios::binary);
+        if (!file.read(buffer.get(), static_cast<std::streamsize>(size))) {
+            throw std::runtime_error("cannot read " + path.string());
+        }
+        data = buffer.get();
+#endif
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file() {
+#if defined(__linux__)
+        if (data != nullptr) {
+            ::munmap(data, size);
+        }
+#endif
+    }
+
+    [[nodiscard]] std::string_view text() const { return {data, size}; }
+
+private:
+    size_t size;
+    char *data = nullptr;
+#if !defined(__linux__)
+    std::unique_ptr<char[]> buffer;
+#endif
+};
+
+// Splits a file into parts of roughly the given weights, each ending on a
+// line boundary. Returns the part boundaries, first 0 and last the size.
+[[nodiscard]] std::vector<size_t> line_aligned_partitions(const std::filesystem::path &path, std::span<const size_t> weights) {
+    const auto size = size_t(std::filesystem::file_size(path));
+    const auto total = std::max<size_t>(1, std::reduce(weights.begin(), weights.end()));
+    auto file = std::ifstream(path, std::ios::binary);
+    auto bounds = std::vector<size_t>{0};
+    auto weight = size_t(0);
+    for (size_t i = 0; i + 1 < weights.size(); i++) {
+        weight += weights[i];
+        auto bound = std::max(bounds.back(), size_t(double(size) * double(weight) / double(total)));
+        if (bound != 0 && bound < size) {
+            file.seekg(static_cast<std::streamoff>(bound - 1));
+            for (char c = 0; file.get(c) && c != '\n'; bound++);
+            file.clear();
+        }
+        bounds.push_back(std::min(bound, size));
+    }
+    bounds.push_back(size);
+    return bounds;
+}
+
+// A run of whole lines inside a pooled input block. This is all the queue
+// carries; the rows themselves stay where the reader put them.
+struct batch_descriptor {
+    std::uint32_t block = 0;
+    std::uint32_t length = 0;
+    std::uint64_t offset = 0;
+    // Position in file order within one reader's part of the file.
+    std::uint64_t sequence = 0;
+};
+
+// Fixed set of input blocks, recycled by reference count. The reader holds a
+// reference while it fills and slices a block, and every descriptor in flight
+// holds one more. The consumer that drops the last reference hands the block
+// back for the reader to refill, so memory stays bounded by the pool rather
+// than the file.
+class block_pool {
+public:
+    block_pool(size_t count, size_t block_size) : blocks(count), block_size(block_size) {
+        for (size_t i = 0; i < count; i++) {
+            blocks[i].data = std::make_unique_for_overwrite<char[]>(block_size);
+            available.push_back(i);
+        }
+    }
+
+    // Waits for a free block and takes the first reference to it. Starved
+    // runs, unlocked, before any wait, so the caller can hand on descriptors
+    // it is still holding; they may pin the very blocks it is waiting for.
+    template <typename Starved>
+    [[nodiscard]] std::uint32_t acquire(Starved &&starved) {
+        auto lock = std::unique_lock(mutex);
+        if (available.empty()) {
+            lock.unlock();
+            starved();
+            lock.lock();
+        }
+        freed.wait(lock, [&]() { return !available.empty(); });
+        const auto block = available.back();
+        available.pop_back();
+        blocks[block].references.store(1, std::memory_order_relaxed);
+        return std::uint32_t(block);
+    }
+
+    void retain(std::uint32_t block) {
+        blocks[block].references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(std::uint32_t block) {
+        if (blocks[block].references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            {
+                auto lock = std::lock_guard(mutex);
+                available.push_back(block);
+            }
+            freed.notify_one();
+        }
+    }
+
+    [[nodiscard]] char *data(std::uint32_t block) { return blocks[block].data.get(); }
+
+    [[nodiscard]] std::string_view text(const batch_descriptor &batch) const {
+        return {blocks[batch.block].data.get() + batch.offset, batch.length};
+    }
+
+    [[nodiscard]] size_t capacity() const { return block_size; }
+
+private:
+    struct alignas(cache_line_size) block {
+        std::unique_ptr<char[]> data;
+        std::atomic<size_t> references = 0;
+    };
+
+    std::vector<block> blocks;
+    size_t block_size;
+    std::mutex mutex;
+    std::condition_variable freed;
+    std::vector<size_t> available;
+};
+
+// Reads bytes [begin, end) of the file block by block into the pool and
+// slices each block into line-aligned descriptors of about batch_bytes. A
+// block ends at its last newline, and the next read starts at that line in
+// the file, so a line is never split or copied. Begin and end must be line
+// starts, as line_aligned_partitions gives.
+class block_reader {
+public:
+    static constexpr auto block_bytes = size_t(4) << 20;
+    static constexpr auto default_batch_bytes = size_t(16) << 10;
+
+    block_reader(const std::filesystem::path &path, block_pool &pool, size_t batch_bytes = default_batch_bytes,
+                 size_t begin = 0, size_t end = std::numeric_limits<size_t>::max())
+        : file(path, std::ios::binary), begin(begin), size(std::min<size_t>(end, std::filesystem::file_size(path))), pool(pool), batch_bytes(batch_bytes) {}
+
+    // Emit gets each descriptor with its text. The descriptor holds a block
+    // reference that the consumer must release. Starved runs when the pool
+    // is empty and must pass on any descriptors emit has held back.
+    template <typename Emit, typename Starved>
+    void read_all(Emit &&emit, Starved &&starved) {
+        auto sequence = std::uint64_t(0);
+        for (auto position = begin; position < size;) {
+            const auto block = pool.acquire(starved);
+            auto *const data = pool.data(block);
+            const auto wanted = std::min(pool.capacity(), size - position);
+            file.seekg(static_cast<std::streamoff>(position));
+            file.read(data, static_cast<std::streamsize>(wanted));
+
+            auto usable = wanted;
+            if (position + wanted < size) {
+                const auto last_newline = std::string_view(data, wanted).rfind('\n');
+                if (last_newline == std::string_view::npos) {
+                    throw std::runtime_error("input line longer than a read block");
+                }
+                usable = last_newline + 1;
+            }
+
+            const auto text = std::string_view(data, usable);
+            for (auto begin = size_t(0); begin < usable;) {
+                auto end = std::min(usable, begin + batch_bytes);
+                if (end < usable) {
+                    // The final block may not end in a newline.
+                    const auto newline = text.find('\n', end - 1);
+                    end = newline == std::string_view::npos ? usable : newline + 1;
+                }
+                pool.retain(block);
+                const auto batch = batch_descriptor{block, std::uint32_t(end - begin), begin, sequence++};
+                emit(batch, text.substr(begin, end - begin));
+                begin = end;
+            }
+            pool.release(block);
+            position += usable;
+        }
+    }
+
+private:
+    std::ifstream file;
+    size_t begin;
+    size_t size;
+    block_pool &pool;
+    size_t batch_bytes;
+};
+
+// Enough blocks that the readers can run ahead of every worker.
+[[nodiscard]] inline size_t pool_blocks(size_t thread_count, size_t readers = 1) {
+    return 2 * thread_count + 4 * readers;
+}
+
+[[nodiscard]] size_t worker_count() {
+    return std::max(2u, std::thread::hardware_concurrency()) - 1;
+}
+
+struct logical_cpu {
+    unsigned id = 0;
+    unsigned package = 0;
+    unsigned core = 0;
+};
+
+// The CPUs this process may run on, read from sysfs. Without topology files
+// every CPU counts as its own core on package 0.
+[[nodiscard]] std::vector<logical_cpu> read_cpu_topology() {
+    auto cpus = std::vector<logical_cpu>();
+#if defined(__linux__)
+    const auto read_number = [](const std::filesystem::path &path, unsigned fallback) {
+        auto file = std::ifstream(path);
+        auto value = 0u;
+        return file >> value ? value : fallback;
+    };
+
+    auto allowed = cpu_set_t();
+    CPU_ZERO(&allowed);
+    const auto restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto error = std::error_code();
+    for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/cpu", error)) {
+        const auto name = entry.path().filename().string();
+        if (name.size() <= 3 || !name.starts_with("cpu") || !std::ranges::all_of(name.substr(3), [](char c) { return c >= '0' && c <= '9'; })) {
+            continue;
+        }
+        const auto id = unsigned(std::stoul(name.substr(3)));
+        if (restricted && (id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed))) {
+            continue;
+        }
+        cpus.push_back({id, read_number(entry.path() / "topology/physical_package_id", 0), read_number(entry.path() / "topology/core_id", id)});
+    }
+#endif
+    if (cpus.empty()) {
+        for (auto id = 0u; id < std::max(1u, std::thread::hardware_concurrency()); id++) {
+            cpus.push_back({id, 0, id});
+        }
+    }
+    std::ranges::sort(cpus, {}, &logical_cpu::id);
+    return cpus;
+}
+
+// "0-3,8-11" as in sysfs cpulist files.
+[[nodiscard]] std::vector<unsigned> parse_cpu_list(std::string_view list) {
+    auto cpus = std::vector<unsigned>();
+    for (const auto item : std::views::split(list, ',')) {
+        const auto range = std::string(item.begin(), item.end());
+        if (range.find_first_of("0123456789") == std::string::npos) {
+            continue;
+        }
+        const auto dash = range.find('-');
+        const auto first = unsigned(std::stoul(range.substr(0, dash)));
+        const auto last = dash == std::string::npos ? first : unsigned(std::stoul(range.substr(dash + 1)));
+        for (auto cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The usable CPUs of every NUMA node that has any. Without node information
+// the machine is a single node.
+[[nodiscard]] std::vector<std::vector<unsigned>> read_numa_nodes() {
+    auto usable = std::vector<unsigned>();
+    for (const auto &cpu : read_cpu_topology()) {
+        usable.push_back(cpu.id);
+    }
+
+    auto nodes = std::map<unsigned, std::vector<unsigned>>();
+#if defined(__linux__)
+    auto error = std::error_code();
+    for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        const auto name = entry.path().filename().string();
+        if (name.size() <= 4 || !name.starts_with("node") || !std::ranges::all_of(name.substr(4), [](char c) { return c >= '0' && c <= '9'; })) {
+            continue;
+        }
+        auto file = std::ifstream(entry.path() / "cpulist");
+        auto list = std::string();
+        std::getline(file, list);
+        auto cpus = parse_cpu_list(list);
+        std::erase_if(cpus, [&](unsigned cpu) { return !std::ranges::binary_search(usable, cpu); });
+        if (!cpus.empty()) {
+            nodes[unsigned(std::stoul(name.substr(4)))] = std::move(cpus);
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        return {usable};
+    }
+    auto result = std::vector<std::vector<unsigned>>();
+    for (auto &[node, cpus] : nodes) {
+        result.push_back(std::move(cpus));
+    }
+    return result;
+}
+
+enum class placement_policy {
+    none,
+    compact,
+    scatter,
+    physical,
+};
+
+// compact fills a core's SMT siblings, then the rest of its package, before
+// moving on. scatter alternates packages, then cores, and only doubles up on
+// SMT siblings once every core has a thread. physical is compact with one
+// thread per core.
+[[nodiscard]] std::vector<unsigned> placement_order(std::vector<logical_cpu> cpus, placement_policy policy) {
+    if (policy == placement_policy::none) {
+        return {};
+    }
+    std::ranges::sort(cpus, [](const logical_cpu &a, const logical_cpu &b) {
+        return std::tie(a.package, a.core, a.id) < std::tie(b.package, b.core, b.id);
+    });
+
+    struct ranked_cpu {
+        unsigned sibling;
+        unsigned core;
+        unsigned package;
+        unsigned id;
+    };
+    auto ranked = std::vector<ranked_cpu>();
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (i == 0 || cpus[i].package != cpus[i - 1].package) {
+            ranked.push_back({0, 0, cpus[i].package, cpus[i].id});
+        } else if (cpus[i].core != cpus[i - 1].core) {
+            ranked.push_back({0, ranked.back().core + 1, cpus[i].package, cpus[i].id});
+        } else {
+            ranked.push_back({ranked.back().sibling + 1, ranked.back().core, cpus[i].package, cpus[i].id});
+        }
+    }
+
+    if (policy == placement_policy::physical) {
+        std::erase_if(ranked, [](const ranked_cpu &cpu) { return cpu.sibling != 0; });
+    } else if (policy == placement_policy::scatter) {
+        std::ranges::stable_sort(ranked, [](const ranked_cpu &a, const ranked_cpu &b) {
+            return std::tie(a.sibling, a.core, a.package) < std::tie(b.sibling, b.core, b.package);
+        });
+    }
+
+    auto order = std::vector<unsigned>();
+    for (const auto &cpu : ranked) {
+        order.push_back(cpu.id);
+    }
+    return order;
+}
+
+inline void pin_current_thread(unsigned cpu) {
+#if defined(__linux__)
+    auto set = cpu_set_t();
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    static_cast<void>(cpu);
+#endif
+}
+
+// Hands out CPUs in policy order. A producer takes the first one, so it
+// shares a package, and under compact a neighbourhood, with the first
+// workers. More threads than CPUs wrap around. Threads pin themselves before
+// touching their tables, which keeps first-touch pages on their node.
+class thread_placement {
+public:
+    thread_placement() = default;
+
+    // The first producers slots in the order go to reader threads.
+    thread_placement(placement_policy policy, size_t producers)
+        : order(placement_order(read_cpu_topology(), policy)), first_worker(producers) {}
+
+    explicit thread_placement(std::vector<unsigned> cpus) : order(std::move(cpus)) {}
+
+    void pin_producer(size_t producer = 0) const { pin(producer); }
+
+    void pin_worker(size_t worker) const { pin(worker + first_worker); }
+
+private:
+    void pin(size_t slot) const {
+        if (!order.empty()) {
+            pin_current_thread(order[slot % order.size()]);
+        }
+    }
+
+    std::vector<unsigned> order;
+    size_t first_worker = 0;
+};
+
+class hyperloglog {
+public:
+    static constexpr auto precision = 14;
+    static constexpr auto register_count = size_t(1) << precision;
+
+    void add(std::uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccd;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53;
+        hash ^= hash >> 33;
+        const auto index = hash >> (64 - precision);
+        const auto rank = static_cast<std::uint8_t>(std::countl_zero((hash << precision) | (std::uint64_t(1) << (precision - 1))) + 1);
+        registers[index] = std::max(registers[index], rank);
+    }
+
+    [[nodiscard]] double estimate() const {
+        const auto m = static_cast<double>(register_count);
+        auto sum = 0.0;
+        auto zeros = size_t(0);
+        for (const auto rank : registers) {
+            sum += std::ldexp(1.0, -rank);
+            zeros += rank == 0;
+        }
+        const auto raw = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+        if (raw <= 2.5 * m && zeros != 0) {
+            return m * std::log(m / static_cast<double>(zeros));
+        }
+        return raw;
+    }
+
+private:
+    std::array<std::uint8_t, register_count> registers = {};
+};
+
+struct cardinality_sample {
+    size_t rows = 0;
+    size_t sampled_bytes = 0;
+    size_t file_bytes = 0;
+    double estimate = 0.0;
+    double prefix_hash_estimate = 0.0;
+};
+
+// Reads a handful of evenly spaced chunks and sketches the station names in
+// them, both with a full-key hash and with station_hash. A prefix hash that
+// sees noticeably fewer distinct keys is collapsing stations onto one hash.
+[[nodiscard]] cardinality_sample sample_cardinality(
+        const std::filesystem::path &path,
+        const std::optional<group_key> &grouping = std::nullopt,
+        size_t chunk_count = 32,
+        size_t chunk_size = size_t(256) << 10) {
+    auto result = cardinality_sample();
+    auto extractor = grouping ? std::optional<key_extractor>(std::in_place, *grouping) : std::nullopt;
+    auto file = std::ifstream(path, std::ios::binary);
+    result.file_bytes = std::filesystem::file_size(path);
+
+    auto full = hyperloglog();
+    auto prefix = hyperloglog();
+    auto chunk = std::string();
+    const auto stride = std::max(chunk_size, result.file_bytes / chunk_count);
+    for (size_t offset = 0; offset < result.file_bytes; offset += stride) {
+        chunk.resize(std::min(chunk_size, result.file_bytes - offset));
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        result.sampled_bytes += chunk.size();
+
+        // Past the head, a chunk starts mid-line; skip to the next line.
+        auto cursor = size_t(0);
+        if (offset != 0) {
+            const auto newline = chunk.find('\n');
+            if (newline == std::string::npos) {
+                continue;
+            }
+            cursor = newline + 1;
+        }
+        const auto at_end = offset + chunk.size() == result.file_bytes;
+        while (cursor < chunk.size()) {
+            auto end = chunk.find('\n', cursor);
+            if (end == std::string::npos) {
+                // The file's last line may not end in a newline.
+                if (!at_end) {
+                    break;
+                }
+                end = chunk.size();
+            }
+            auto name = std::string_view(chunk).substr(cursor, chunk.find(';', cursor) - cursor);
+            if (extractor) {
+                const auto line = std::string_view(chunk).substr(cursor, end - cursor);
+                name = extractor->key(line.substr(0, line.rfind(';')));
+            }
+            full.add(wy_hash::hash(name));
+            prefix.add(station_hash::hash(name));
+            result.rows++;
+            cursor = end + 1;
+        }
+    }
+
+    result.estimate = full.estimate();
+    result.prefix_hash_estimate = prefix.estimate();
+    return result;
+}
+
+enum class table_mode {
+    automatic,
+    per_thread,
+    shared,
+};
+
+constexpr auto shared_table_threshold = size_t(64) << 20;
+
+struct execution_plan {
+    size_t estimated_stations = 0;
+    size_t table_capacity = 0;
+    table_mode mode = table_mode::per_thread;
+    bool full_key_hash = false;
+};
+
+[[nodiscard]] execution_plan plan_execution(
+        const std::filesystem::path &input,
+        table_mode requested,
+        std::optional<size_t> stations,
+        size_t thread_count,
+        const std::optional<group_key> &grouping = std::nullopt) {
+    auto plan = execution_plan();
+    if (stations) {
+        plan.estimated_stations = *stations;
+    } else {
+        const auto sample = sample_cardinality(input, grouping);
+        auto estimate = sample.estimate;
+        if (sample.rows != 0 && estimate * 2 > static_cast<double>(sample.rows) && sample.sampled_bytes < sample.file_bytes) {
+            estimate *= static_cast<double>(sample.file_bytes) / static_cast<double>(sample.sampled_bytes);
+        }
+        plan.estimated_stations = static_cast<size_t>(estimate * 1.1) + 1;
+        plan.full_key_hash = sample.prefix_hash_estimate < sample.estimate * 0.9;
+    }
+
+    plan.table_capacity = std::bit_ceil(std::max<size_t>(plan.estimated_stations * 2, 64));
+    plan.mode = requested;
+    if (plan.mode == table_mode::automatic) {
+        const auto per_thread_bytes = plan.table_capacity * station_table::bytes_per_slot;
+        plan.mode = per_thread_bytes * thread_count > shared_table_threshold ? table_mode::shared : table_mode::per_thread;
+    }
+    if (plan.mode == table_mode::shared) {
+        plan.table_capacity *= 2;
+    }
+    return plan;
+}
+
+// Pairwise tree reduction of per-worker tables. A worker that has drained the
+// queue folds in its partners' tables as soon as each of them arrives, so the
+// merge overlaps with stragglers and finishes in log2(n) rounds.
+template <typename Table>
+class tree_reduction {
+public:
+    explicit tree_reduction(std::vector<Table> &tables) : tables(tables), reduced(tables.size()) {}
+
+    void arrive(size_t i) {
+        for (size_t step = 1; i % (step * 2) == 0 && i + step < tables.size(); step *= 2) {
+            reduced[i + step].wait(false, std::memory_order_acquire);
+            tables[i].merge(tables[i + step]);
+        }
+        reduced[i].store(true, std::memory_order_release);
+        reduced[i].notify_one();
+    }
+
+    [[nodiscard]] const Table &result() const { return tables.front(); }
+
+private:
+    std::vector<Table> &tables;
+    std::vector<std::atomic<bool>> reduced;
+};
+
+// Tracks which windows no batch can still touch. Assumes rows arrive in
+// timestamp order: once every batch before the first one to start in window W
+// has completed, all windows below W are closed. Completion is recorded once
+// per batch, so the mutex is not on the per-row path.
+class window_watermark {
+public:
+    void started(size_t sequence, std::int64_t window) {
+        auto lock = std::lock_guard(mutex);
+        if (boundaries.empty() || window > boundaries.back().second) {
+            boundaries.emplace_back(sequence, window);
+        }
+    }
+
+    // True when this moved the watermark.
+    bool completed(size_t sequence) {
+        auto lock = std::lock_guard(mutex);
+        finished.insert(sequence);
+        while (!finished.empty() && *finished.begin() == prefix) {
+            finished.erase(finished.begin());
+            prefix++;
+        }
+        const auto previous = closed_window.load(std::memory_order_relaxed);
+        auto closed = previous;
+        auto boundary = boundaries.begin();
+        for (; boundary != boundaries.end() && boundary->first <= prefix; ++boundary) {
+            closed = boundary->second;
+        }
+        boundaries.erase(boundaries.begin(), boundary);
+        closed_window.store(closed, std::memory_order_release);
+        return closed != previous;
+    }
+
+    // Windows strictly below this are closed.
+    [[nodiscard]] std::int64_t closed_before() const { return closed_window.load(std::memory_order_acquire); }
+
+private:
+    std::mutex mutex;
+    std::vector<std::pair<size_t, std::int64_t>> boundaries;
+    std::set<size_t> finished;
+    size_t prefix = 0;
+    std::atomic<std::int64_t> closed_window = std::numeric_limits<std::int64_t>::min();
+};
+
+// One table per open window on a worker. Rows are mostly in order, so the
+// last window's table is cached ahead of the map lookup.
+template <typename Table>
+class window_tables {
+public:
+    window_tables(size_t capacity, aggregate_features features) : capacity(capacity), features(std::move(features)) {}
+
+    // Null for windows this worker has already released.
+    [[nodiscard]] Table *find_or_open(std::int64_t window) {
+        if (last != nullptr && window == last_window) {
+            return last;
+        }
+        if (window < released) {
+            return nullptr;
+        }
+        auto found = open.find(window);
+        if (found == open.end()) {
+            found = open.try_emplace(window, capacity, features).first;
+        }
+        last_window = window;
+        last = &found->second;
+        return last;
+    }
+
+    template <typename Sink>
+    void release_before(std::int64_t bound, Sink &&sink) {
+        const auto end = open.lower_bound(bound);
+        for (auto it = open.begin(); it != end; ++it) {
+            sink(it->first, std::move(it->second));
+        }
+        open.erase(open.begin(), end);
+        released = std::max(released, bound);
+        last = nullptr;
+    }
+
+    [[nodiscard]] std::int64_t released_before() const { return released; }
+
+private:
+    size_t capacity;
+    aggregate_features features;
+    std::map<std::int64_t, Table> open;
+    std::int64_t released = std::numeric_limits<std::int64_t>::min();
+    std::int64_t last_window = 0;
+    Table *last = nullptr;
+};
+
+inline void spin_pause() {
+#if defined(__SSE4_2__) || defined(_MSC_VER)
+    _mm_pause();
+#endif
+}
+
+// The queue plus a wait strategy. A consumer that finds it empty spins
+// briefly, then yields, then parks on a futex-backed counter until the
+// producer publishes, wakes it or closes the channel. close() is the
+// end-of-input signal: pop() returns null once the channel is closed and
+// drained.
+//
+// Items move through producer and consumer handles. Each handle owns an
+// explicit moodycamel token and stages up to `bulk` items, so one
+// enqueue_bulk or try_dequeue_bulk moves many batches and the queue's
+// implicit-producer lookup is skipped.
+template <typename T>
+class batch_channel {
+public:
+    static constexpr auto spin_attempts = 64u;
+    static constexpr auto yield_attempts = 16u;
+
+    // Time spent inside successful queue calls, and the queue depth as seen
+    // by size_approx after every enqueue. Only collected when the channel is
+    // built with statistics on; the clock reads and size_approx are not free.
+    struct statistics {
+        std::atomic<std::uint64_t> items = 0;
+        std::atomic<std::uint64_t> enqueue_calls = 0;
+        std::atomic<std::uint64_t> dequeue_calls = 0;
+        std::atomic<std::uint64_t> enqueue_ns = 0;
+        std::atomic<std::uint64_t> dequeue_ns = 0;
+        std::atomic<std::uint64_t> depth_total = 0;
+        std::atomic<std::uint64_t> depth_max = 0;
+    };
+
+    // One per producing thread.
+    class producer {
+    public:
+        explicit producer(batch_channel &channel) : channel(channel), token(channel.queue) {
+            staged.reserve(channel.bulk);
+        }
+
+        void push(T &&item) {
+            staged.push_back(std::move(item));
+            if (staged.size() == channel.bulk) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (staged.empty()) {
+                return;
+            }
+            if (!channel.collect_statistics) {
+                channel.queue.enqueue_bulk(token, std::make_move_iterator(staged.begin()), staged.size());
+                staged.clear();
+                channel.publish();
+                return;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            channel.queue.enqueue_bulk(token, std::make_move_iterator(staged.begin()), staged.size());
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            auto &stats = channel.stats;
+            const auto depth = std::uint64_t(channel.queue.size_approx());
+            stats.items.fetch_add(staged.size(), std::memory_order_relaxed);
+            stats.enqueue_calls.fetch_add(1, std::memory_order_relaxed);
+            stats.enqueue_ns.fetch_add(std::uint64_t(elapsed), std::memory_order_relaxed);
+            stats.depth_total.fetch_add(depth, std::memory_order_relaxed);
+            stats.depth_max.store(std::max(stats.depth_max.load(std::memory_order_relaxed), depth), std::memory_order_relaxed);
+            staged.clear();
+            channel.publish();
+        }
+
+        // Flushes and signals that this producer is done. Input ends when
+        // every producer the channel was built for has closed.
+        void close() {
+            flush();
+            channel.open_producers.fetch_sub(1);
+            channel.publish();
+        }
+
+    private:
+        batch_channel &channel;
+        moodycamel::ProducerToken token;
+        std::vector<T> staged;
+    };
+
+    // One per consuming thread. Popped items stay valid until the next pop.
+    class consumer {
+    public:
+        explicit consumer(batch_channel &channel) : channel(channel), token(channel.queue), items(channel.bulk) {}
+
+        [[nodiscard]] T *pop() {
+            return pop([](){});
+        }
+
+        // Idle runs before every park.
+        template <typename Idle>
+        [[nodiscard]] T *pop(Idle &&idle) {
+            if (next == count) {
+                next = 0;
+                count = channel.wait(idle, [&]() {
+                    return channel.queue.try_dequeue_bulk(token, items.begin(), items.size());
+                });
+                if (count == 0) {
+                    return nullptr;
+                }
+            }
+            return &items[next++];
+        }
+
+    private:
+        batch_channel &channel;
+        moodycamel::ConsumerToken token;
+        std::vector<T> items;
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    explicit batch_channel(size_t bulk = 8, size_t producers = 1, bool collect_statistics = false)
+        : bulk(std::max<size_t>(1, bulk)), collect_statistics(collect_statistics), open_producers(producers) {}
+
+    // Wakes parked consumers so their idle hook runs again.
+    void wake() { publish(); }
+
+    [[nodiscard]] const statistics &statistics_so_far() const { return stats; }
+
+private:
+    template <typename Idle, typename Attempt>
+    [[nodiscard]] size_t wait(Idle &idle, Attempt &&attempt) {
+        const auto timed = [&]() {
+            if (!collect_statistics) {
+                return attempt();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            const auto taken = attempt();
+            if (taken != 0) {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                stats.dequeue_calls.fetch_add(1, std::memory_order_relaxed);
+                stats.dequeue_ns.fetch_add(std::uint64_t(elapsed), std::memory_order_relaxed);
+            }
+            return taken;
+        };
+
+        for (auto tries = 0u;; tries++) {
+            if (const auto taken = timed()) {
+                return taken;
+            }
+            // Anything published after this load changes the counter, so
+            // the wait below cannot miss it.
+            const auto seen = published.load();
+            if (const auto taken = timed()) {
+                return taken;
+            }
+            if (open_producers.load() == 0) {
+                return timed();
+            }
+
+            if (tries < spin_attempts) {
+                spin_pause();
+            } else if (tries < spin_attempts + yield_attempts) {
+                std::this_thread::yield();
+            } else {
+                idle();
+                published.wait(seen);
+                tries = 0;
+            }
+        }
+    }
+
+    void publish() {
+        published.fetch_add(1);
+        published.notify_all();
+    }
+
+    size_t bulk;
+    bool collect_statistics;
+    moodycamel::ConcurrentQueue<T> queue;
+    alignas(cache_line_size) std::atomic<std::uint32_t> published = 0;
+    std::atomic<size_t> open_producers;
+    statistics stats;
+};
+
+template <typename T>
+void print_queue_statistics(std::ostream &out, const typename batch_channel<T>::statistics &stats, std::uint64_t rows) {
+    const auto per_row = [&](const std::atomic<std::uint64_t> &ns) { return rows == 0 ? 0.0 : double(ns.load()) / double(rows); };
+    const auto calls = std::max<std::uint64_t>(1, stats.enqueue_calls.load());
+    out << std::fixed << std::setprecision(2)
+        << "queue: " << stats.items.load() << " batches, " << rows << " rows, "
+        << stats.enqueue_calls.load() << " enqueues, " << stats.dequeue_calls.load() << " dequeues, "
+        << per_row(stats.enqueue_ns) << " ns/row enqueue, " << per_row(stats.dequeue_ns) << " ns/row dequeue, depth "
+        << double(stats.depth_total.load()) / double(calls) << " avg " << stats.depth_max.load() << " max\n";
+}
+
+// Reader threads split lines and feed batches through a channel. This is
+// the original pipeline. Windowed runs still use it, with a single reader,
+// because then it hands batches out in file order.
+struct queue_source {
+    batch_channel<batch_descriptor> &batches;
+    block_pool &pool;
+
+    template <typename Body>
+    void drain(size_t, Body &&body) {
+        auto consumer = batch_channel<batch_descriptor>::consumer(batches);
+        while (const auto *batch = consumer.pop()) {
+            body(pool.text(*batch));
+            pool.release(batch->block);
+        }
+    }
+};
+
+// Splits the input into one newline-aligned range per worker. Workers parse
+// their own range in chunks straight from the buffer. A worker whose range
+// runs dry steals the back half of the fullest remaining range, so stragglers
+// are split up as the scan nears its end. Every range boundary is a line
+// start. The locks are taken once per chunk, never per row.
+class range_scheduler {
+public:
+    static constexpr auto default_chunk_bytes = size_t(64) << 10;
+
+    range_scheduler(std::string_view text, size_t workers, size_t chunk_size = default_chunk_bytes)
+        : text(text), chunk_size(chunk_size), ranges(std::make_unique<work_range[]>(workers)), workers(workers) {
+        auto begin = size_t(0);
+        for (size_t i = 0; i < workers; i++) {
+            const auto end = i + 1 == workers ? text.size() : std::max(begin, line_start(text.size() / workers * (i + 1)));
+            ranges[i].begin.store(begin, std::memory_order_relaxed);
+            ranges[i].end.store(end, std::memory_order_relaxed);
+            begin = end;
+        }
+    }
+
+    template <typename Body>
+    void drain(size_t worker, Body &&body) {
+        while (true) {
+            if (const auto chunk = claim(worker)) {
+                body(*chunk);
+            } else if (!steal(worker)) {
+                break;
+            }
+        }
+    }
+
+private:
+    struct alignas(cache_line_size) work_range {
+        std::mutex mutex;
+        // Written under the mutex, read without it to pick a victim.
+        std::atomic<size_t> begin = 0;
+        std::atomic<size_t> end = 0;
+    };
+
+    // First line start at or after offset.
+    [[nodiscard]] size_t line_start(size_t offset) const {
+        if (offset == 0 || offset >= text.size()) {
+            return std::min(offset, text.size());
+        }
+        const auto newline = text.find('\n', offset - 1);
+        return newline == std::string_view::npos ? text.size() : newline + 1;
+    }
+
+    [[nodiscard]] std::optional<std::string_view> claim(size_t worker) {
+        auto &range = ranges[worker];
+        auto lock = std::lock_guard(range.mutex);
+        const auto begin = range.begin.load(std::memory_order_relaxed);
+        const auto end = range.end.load(std::memory_order_relaxed);
+        if (begin >= end) {
+            return std::nullopt;
+        }
+        const auto split = std::min(end, line_start(begin + chunk_size));
+        range.begin.store(split, std::memory_order_relaxed);
+        return text.substr(begin, split - begin);
+    }
+
+    // Ranges with a chunk or less left are finished by their owner.
+    [[nodiscard]] bool steal(size_t thief) {
+        while (true) {
+            auto victim = workers;
+            auto most = chunk_size;
+            for (size_t i = 0; i < workers; i++) {
+                const auto begin = ranges[i].begin.load(std::memory_order_relaxed);
+                const auto end = ranges[i].end.load(std::memory_order_relaxed);
+                if (i != thief && end > begin && end - begin > most) {
+                    victim = i;
+                    most = end - begin;
+                }
+            }
+            if (victim == workers) {
+                return false;
+            }
+
+            auto stolen_begin = size_t(0);
+            auto stolen_end = size_t(0);
+            {
+                auto &range = ranges[victim];
+                auto lock = std::lock_guard(range.mutex);
+                const auto begin = range.begin.load(std::memory_order_relaxed);
+                const auto end = range.end.load(std::memory_order_relaxed);
+                if (end <= begin || end - begin <= chunk_size) {
+                    continue;
+                }
+                stolen_begin = line_start(begin + (end - begin) / 2);
+                if (stolen_begin >= end) {
+                    continue;
+                }
+                stolen_end = end;
+                range.end.store(stolen_begin, std::memory_order_relaxed);
+            }
+
+            // Nobody steals from an empty range, so the victim's lock need
+            // not be held while this one is refilled.
+            auto &own = ranges[thief];
+            auto lock = std::lock_guard(own.mutex);
+            own.begin.store(stolen_begin, std::memory_order_relaxed);
+            own.end.store(stolen_end, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    std::string_view text;
+    size_t chunk_size;
+    std::unique_ptr<work_range[]> ranges;
+    size_t workers;
+};
+
+// Setup runs on each worker thread and returns the table that worker
+// aggregates into. Constructing a table zeroes it, so per-thread tables are
+// first touched, and therefore placed on the memory node, of their owner.
+// Finish runs on the same worker once the source is drained.
+template <typename Source, typename Setup, typename Finish>
+std::vector<std::thread> dispatch_threads(
+        Source &source,
+        size_t thread_count,
+        const thread_placement &placement,
+        const station_filter &filter,
+        const std::optional<group_key> &grouping,
+        Setup setup,
+        Finish finish) {
+    auto threads = std::vector<std::thread>();
+
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, setup, finish, i](){
+            placement.pin_worker(i);
+            auto &data = setup(i);
+            auto extractor = grouping ? std::optional<key_extractor>(std::in_place, *grouping) : std::nullopt;
+            with_matcher<typename std::remove_reference_t<decltype(data)>::hash_type>(filter, [&](auto &matcher) {
+                source.drain(i, [&](auto work) {
+                    if (extractor) {
+                        process_batch(work, data, matcher, *extractor);
+                    } else {
+                        process_batch(work, data, matcher);
+                    }
+                });
+            });
+            finish(i);
+        });
+    }
+
+    return threads;
+}
+
+[[nodiscard]] std::vector<std::string> read_station_names(const std::filesystem::path &path) {
+    auto file = std::ifstream(path);
+    auto names = std::vector<std::string>();
+    auto line = std::string();
+    while (std::getline(file, line)) {
+        const auto semicolon = line.find(';');
+        names.emplace_back(line.substr(0, semicolon));
+    }
+    std::ranges::sort(names);
+    names.erase(std::ranges::unique(names).begin(), names.end());
+    return names;
+}
+
+template <typename Hash>
+void benchmark_hash(const std::vector<std::string> &names) {
+    constexpr auto rounds = size_t(2'000);
+
+    auto sink = std::uint64_t(0);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        for (const auto &name : names) {
+            sink += Hash::hash(name);
+        }
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    auto table = aggregation_table<Hash>(names.size() * 2);
+    for (const auto &name : names) {
+        (void)table.find_or_insert(name);
+    }
+    const auto probes = table.probes();
+
+    std::cout << std::left << std::setw(22) << Hash::name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(8) << elapsed / static_cast<double>(rounds * names.size()) << " ns/key"
+              << std::setw(8) << probes.hash_collisions << " hash collisions"
+              << std::setw(8) << probes.home_collisions << " slot collisions"
+              << std::setw(8) << probes.average_probe << " avg probe"
+              << std::setw(6) << probes.max_probe << " max probe"
+              << (sink == 0 ? " " : "") << '\n';
+}
+
+void benchmark_hashes(const std::filesystem::path &path) {
+    const auto names = read_station_names(path);
+    std::cout << names.size() << " stations, table capacity " << std::bit_ceil(names.size() * 2) << '\n';
+    benchmark_hash<std_hash>(names);
+    benchmark_hash<multiply_xorshift_hash<8>>(names);
+    benchmark_hash<multiply_xorshift_hash<16>>(names);
+    benchmark_hash<crc32c_hash>(names);
+    benchmark_hash<wy_hash>(names);
+}
+
+[[nodiscard]] std::vector<std::string> synthetic_lines(size_t stations, size_t rows) {
+    auto random = std::mt19937_64(stations);
+    auto names = std::vector<std::string>(stations);
+    for (size_t i = 0; i < stations; i++) {
+        names[i] = "station-" + std::to_string(i) + std::string(random() % 16, 'x');
+    }
+
+    auto lines = std::vector<std::string>(rows);
+    for (auto &line : lines) {
+        const auto tenths = static_cast<int>(random() % 1999) - 999;
+        auto value = std::to_string(std::abs(tenths) / 10) + '.' + std::to_string(std::abs(tenths) % 10);
+        line = names[random() % stations] + ';' + (tenths < 0 ? "-" : "") + value;
+    }
+    return lines;
+}
+
+// Samples synthetic files whose station counts are known, including ones
+// smaller than a single sample chunk, and reports any estimate more than 5%
+// off. Returns false on a miss.
+[[nodiscard]] bool check_sampler() {
+    const auto path = std::filesystem::temp_directory_path() / "1brc-check-sampler.txt";
+    auto passed = true;
+    for (const auto &[stations, rows] : {std::pair{size_t(416), size_t(5'000)}, std::pair{size_t(10'000), size_t(400'000)}}) {
+        const auto lines = synthetic_lines(stations, rows);
+        auto names = std::set<std::string_view>();
+        auto file = std::ofstream(path, std::ios::binary);
+        for (const auto &line : lines) {
+            names.insert(std::string_view(line).substr(0, line.find(';')));
+            file << line << '\n';
+        }
+        file.close();
+
+        const auto estimate = sample_cardinality(path).estimate;
+        const auto ok = std::abs(estimate - double(names.size())) <= 0.05 * double(names.size());
+        std::cout << (ok ? "ok   " : "FAIL ") << rows << " rows, " << std::filesystem::file_size(path) << " bytes: "
+                  << names.size() << " stations, estimated " << std::fixed << std::setprecision(0) << estimate << '\n';
+        passed = passed && ok;
+    }
+    std::filesystem::remove(path);
+    return passed;
+}
+
+template <typename Body>
+[[nodiscard]] double time_ms(Body body) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run_slices(std::span<const std::string> lines, size_t thread_count, const std::function<void(size_t, std::span<const std::string>)> &body) {
+    auto threads = std::vector<std::thread>();
+    const auto slice = (lines.size() + thread_count - 1) / thread_count;
+    for (size_t i = 0; i < thread_count; i++) {
+        const auto begin = std::min(lines.size(), i * slice);
+        const auto end = std::min(lines.size(), begin + slice);
+        threads.emplace_back(body, i, lines.subspan(begin, end - begin));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void benchmark_tables(size_t thread_count) {
+    for (const auto stations : {size_t(413), size_t(100'000)}) {
+        const auto lines = synthetic_lines(stations, 2'000'000);
+        const auto capacity = std::bit_ceil(stations * 2);
+
+        auto entries = std::vector<station_table>(thread_count);
+        const auto per_thread_aggregate = time_ms([&](){
+            run_slices(lines, thread_count, [&](size_t i, std::span<const std::string> slice){
+                entries[i] = station_table(capacity);
+                process_batch(slice, entries[i]);
+            });
+        });
+        auto per_thread_result = station_table(capacity);
+        const auto per_thread_merge = time_ms([&](){
+            for (const auto &entry : entries) {
+                per_thread_result.merge(entry);
+            }
+        });
+
+        auto shared = shared_station_table(capacity);
+        const auto shared_aggregate = time_ms([&](){
+            run_slices(lines, thread_count, [&](size_t, std::span<const std::string> slice){
+                process_batch(slice, shared);
+            });
+        });
+        auto shared_result = station_table(capacity);
+        const auto shared_merge = time_ms([&](){
+            shared.merge_into(shared_result);
+        });
+
+        std::cout << stations << " stations, " << thread_count << " threads, " << lines.size() << " rows\n" << std::fixed << std::setprecision(2)
+                  << "  per-thread: " << per_thread_aggregate << " ms aggregate, " << per_thread_merge << " ms merge\n"
+                  << "  shared:     " << shared_aggregate << " ms aggregate, " << shared_merge << " ms merge\n";
+    }
+}
+
+template <typename Storage>
+void benchmark_layout(std::span<const std::string> lines, size_t stations, size_t table_count) {
+    const auto capacity = std::bit_ceil(stations * 2);
+
+    auto single = aggregation_table<station_hash, Storage>(capacity);
+    const auto update = time_ms([&](){
+        process_batch(lines, single);
+    });
+
+    auto tables = std::vector<aggregation_table<station_hash, Storage>>(table_count);
+    const auto slice = lines.size() / table_count;
+    for (size_t i = 0; i < table_count; i++) {
+        tables[i] = aggregation_table<station_hash, Storage>(capacity);
+        process_batch(lines.subspan(i * slice, slice), tables[i]);
+    }
+    auto result = aggregation_table<station_hash, Storage>(capacity);
+    const auto merge = time_ms([&](){
+        for (const auto &table : tables) {
+            result.merge(table);
+        }
+    });
+
+    std::cout << "  " << std::left << std::setw(18) << Storage::name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(8) << static_cast<double>(lines.size()) / update / 1'000.0 << " M rows/s update, "
+              << std::setw(8) << merge << " ms merging " << table_count << " tables\n";
+}
+
+void benchmark_layouts() {
+    for (const auto stations : {size_t(413), size_t(100'000)}) {
+        const auto lines = synthetic_lines(stations, 2'000'000);
+        std::cout << stations << " stations, " << lines.size() << " rows\n";
+        benchmark_layout<array_of_structs>(lines, stations, 16);
+        benchmark_layout<struct_of_arrays>(lines, stations, 16);
+    }
+}
+
+void benchmark_merge() {
+    constexpr auto stations = size_t(100'000);
+    const auto lines = synthetic_lines(stations, 4'000'000);
+    const auto capacity = std::bit_ceil(stations * 2);
+
+    std::cout << stations << " stations, " << lines.size() << " rows\n";
+    for (size_t thread_count = 1; thread_count <= std::max<size_t>(16, std::thread::hardware_concurrency()); thread_count *= 2) {
+        auto tables = std::vector<station_table>(thread_count);
+        run_slices(lines, thread_count, [&](size_t i, std::span<const std::string> slice){
+            tables[i] = station_table(capacity);
+            process_batch(slice, tables[i]);
+        });
+
+        const auto serial = time_ms([&](){
+            auto result = station_table(capacity);
+            for (const auto &table : tables) {
+                result.merge(table);
+            }
+        });
+
+        auto reduction = tree_reduction<station_table>(tables);
+        const auto tree = time_ms([&](){
+            auto threads = std::vector<std::thread>();
+            for (size_t i = 0; i < thread_count; i++) {
+                threads.emplace_back([&, i](){ reduction.arrive(i); });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        });
+
+        std::cout << std::setw(4) << thread_count << " tables: " << std::fixed << std::setprecision(2)
+                  << std::setw(8) << serial << " ms serial, " << std::setw(8) << tree << " ms tree\n";
+    }
+}
+
+// ranges and coroutines parse straight from memory; queue is the reader and
+// channel pipeline.
+enum class scheduler_kind {
+    ranges,
+    queue,
+    coroutines,
+};
+
+[[nodiscard]] std::string_view scheduler_name(scheduler_kind scheduler) {
+    switch (scheduler) {
+    case scheduler_kind::ranges:
+        return "ranges";
+    case scheduler_kind::queue:
+        return "queue";
+    case scheduler_kind::coroutines:
+        return "coroutines";
+    }
+    return "?";
+}
+
+struct run_options {
+    std::filesystem::path input = "measurements_large.txt";
+    table_mode mode = table_mode::automatic;
+    std::optional<size_t> estimated_stations;
+    aggregate_features features;
+    std::optional<ranking_query> ranking;
+    station_filter filter;
+    std::optional<group_key> grouping;
+    std::optional<std::int64_t> window_seconds;
+    scheduler_kind scheduler = scheduler_kind::ranges;
+    bool numa = false;
+    std::optional<size_t> threads;
+    placement_policy placement = placement_policy::none;
+    bool print_timing = false;
+    size_t queue_bulk = 8;
+    size_t readers = 1;
+    size_t chunk_bytes = range_scheduler::default_chunk_bytes;
+    size_t batch_bytes = block_reader::default_batch_bytes;
+    bool queue_statistics = false;
+    bool struct_of_arrays = false;
+    bool print_plan = false;
+    bool tune = false;
+};
+
+[[nodiscard]] ranking_query parse_ranking(std::string_view spec, bool highest) {
+    auto query = ranking_query {.highest = highest};
+    const auto colon = spec.find(':');
+    query.k = std::stoull(std::string(spec.substr(0, colon)));
+    const auto column = colon == std::string_view::npos ? std::string_view("mean") : spec.substr(colon + 1);
+    if (column == "min") {
+        query.column = station_column::min;
+    } else if (column == "mean") {
+        query.column = station_column::mean;
+    } else if (column == "max") {
+        query.column = station_column::max;
+    } else if (column == "count") {
+        query.column = station_column::count;
+    } else if (column == "stddev") {
+        query.column = station_column::stddev;
+    } else {
+        throw std::invalid_argument("unknown column " + std::string(column));
+    }
+    return query;
+}
+
+[[nodiscard]] std::vector<size_t> parse_list(std::string_view list) {
+    auto result = std::vector<size_t>();
+    for (const auto item : std::views::split(list, ',')) {
+        result.push_back(std::stoull(std::string(item.begin(), item.end())));
+    }
+    return result;
+}
+
+[[nodiscard]] std::optional<group_key> parse_grouping(std::string_view spec) {
+    if (spec == "station") {
+        return std::nullopt;
+    }
+    auto grouping = group_key();
+    if (spec.starts_with("columns:")) {
+        grouping.by = group_key::kind::columns;
+        grouping.columns = parse_list(spec.substr(8));
+    } else if (spec.starts_with("prefix:")) {
+        grouping.by = group_key::kind::prefix;
+        grouping.prefix_length = std::stoull(std::string(spec.substr(7)));
+    } else if (spec.starts_with("region:")) {
+        grouping.by = group_key::kind::region;
+        auto regions = std::make_shared<std::unordered_map<std::string, std::string>>();
+        auto file = std::ifstream(std::string(spec.substr(7)));
+        auto line = std::string();
+        while (std::getline(file, line)) {
+            const auto semicolon = line.find(';');
+            if (semicolon != std::string::npos) {
+                regions->emplace(line.substr(0, semicolon), line.substr(semicolon + 1));
+            }
+        }
+        grouping.regions = std::move(regions);
+    } else {
+        throw std::invalid_argument("unknown grouping " + std::string(spec));
+    }
+    return grouping;
+}
+
+[[nodiscard]] placement_policy parse_placement(std::string_view policy) {
+    if (policy == "none") {
+        return placement_policy::none;
+    }
+    if (policy == "compact") {
+        return placement_policy::compact;
+    }
+    if (policy == "scatter") {
+        return placement_policy::scatter;
+    }
+    if (policy == "physical") {
+        return placement_policy::physical;
+    }
+    throw std::invalid_argument("unknown placement " + std::string(policy));
+}
+
+[[nodiscard]] scheduler_kind parse_scheduler(std::string_view scheduler) {
+    for (const auto kind : {scheduler_kind::ranges, scheduler_kind::queue, scheduler_kind::coroutines}) {
+        if (scheduler == scheduler_name(kind)) {
+            return kind;
+        }
+    }
+    throw std::invalid_argument("unknown scheduler " + std::string(scheduler));
+}
+
+[[nodiscard]] run_options parse_options(std::span<const std::string_view> args, run_options options = {}) {
+    for (const auto arg : args) {
+        try {
+            if (arg == "--table=per-thread") {
+                options.mode = table_mode::per_thread;
+            } else if (arg == "--table=shared") {
+                options.mode = table_mode::shared;
+            } else if (arg == "--table=auto") {
+                options.mode = table_mode::automatic;
+            } else if (arg.starts_with("--stations=")) {
+                options.estimated_stations = std::stoull(std::string(arg.substr(11)));
+            } else if (arg == "--layout=soa") {
+                options.struct_of_arrays = true;
+            } else if (arg == "--layout=aos") {
+                options.struct_of_arrays = false;
+            } else if (arg == "--stddev") {
+                options.features.variance = true;
+            } else if (arg == "--percentiles") {
+                options.features.percentiles = {50.0, 90.0, 99.0};
+            } else if (arg.starts_with("--percentiles=")) {
+                options.features.percentiles.clear();
+                for (const auto percent : std::views::split(arg.substr(14), ',')) {
+                    options.features.percentiles.push_back(std::stod(std::string(percent.begin(), percent.end())));
+                }
+            } else if (arg.starts_with("--quantiles=")) {
+                options.features.quantiles.clear();
+                for (const auto q : std::views::split(arg.substr(12), ',')) {
+                    options.features.quantiles.push_back(std::stod(std::string(q.begin(), q.end())));
+                }
+            } else if (arg.starts_with("--top=")) {
+                options.ranking = parse_ranking(arg.substr(6), true);
+            } else if (arg.starts_with("--bottom=")) {
+                options.ranking = parse_ranking(arg.substr(9), false);
+            } else if (arg.starts_with("--threads=")) {
+                options.threads = std::stoull(std::string(arg.substr(10)));
+                if (*options.threads == 0) {
+                    throw std::invalid_argument("must be at least 1");
+                }
+            } else if (arg.starts_with("--placement=")) {
+                options.placement = parse_placement(arg.substr(12));
+            } else if (arg == "--numa") {
+                options.numa = true;
+            } else if (arg.starts_with("--readers=")) {
+                options.readers = std::stoull(std::string(arg.substr(10)));
+                if (options.readers == 0) {
+                    throw std::invalid_argument("must be at least 1");
+                }
+            } else if (arg.starts_with("--chunk-bytes=")) {
+                options.chunk_bytes = std::max<size_t>(1, std::stoull(std::string(arg.substr(14))));
+            } else if (arg.starts_with("--batch-bytes=")) {
+                options.batch_bytes = std::max<size_t>(1, std::stoull(std::string(arg.substr(14))));
+            } else if (arg.starts_with("--profile=") || arg == "--no-profile") {
+                // Read by main before the profile is applied.
+            } else if (arg.starts_with("--queue-bulk=")) {
+                options.queue_bulk = std::stoull(std::string(arg.substr(13)));
+            } else if (arg == "--queue-stats") {
+                options.queue_statistics = true;
+            } else if (arg == "--timing") {
+                options.print_timing = true;
+            } else if (arg.starts_with("--scheduler=")) {
+                options.scheduler = parse_scheduler(arg.substr(12));
+            } else if (arg.starts_with("--window=")) {
+                const auto width = arg.substr(9);
+                options.window_seconds = width == "minute" ? 60 : width == "hour" ? 3'600 : width == "day" ? 86'400 : std::stoll(std::string(width));
+                if (*options.window_seconds <= 0) {
+                    throw std::invalid_argument("must be positive");
+                }
+            } else if (arg.starts_with("--group-by=")) {
+                options.grouping = parse_grouping(arg.substr(11));
+            } else if (arg.starts_with("--filter-names=")) {
+                auto file = std::ifstream(std::string(arg.substr(15)));
+                auto name = std::string();
+                while (std::getline(file, name)) {
+                    if (!name.empty()) {
+                        options.filter.names.push_back(name);
+                    }
+                }
+            } else if (arg.starts_with("--filter-prefix=")) {
+                options.filter.prefixes.emplace_back(arg.substr(16));
+            } else if (arg.starts_with("--filter-regex=")) {
+                options.filter.pattern.emplace(std::string(arg.substr(15)), std::regex::optimize);
+            } else if (arg.starts_with("--sketch-compression=")) {
+                options.features.compression = std::stod(std::string(arg.substr(21)));
+            } else if (arg == "--plan") {
+                options.print_plan = true;
+            } else if (arg == "--tune") {
+                options.tune = true;
+            } else if (arg.starts_with("--")) {
+                throw std::invalid_argument("unknown option");
+            } else {
+                options.input = arg;
+            }
+        } catch (const std::logic_error &error) {
+            // Names the argument when std::stoull and friends reject a value.
+            throw std::invalid_argument(std::string(arg) + ": " + error.what());
+        }
+    }
+    if (options.ranking && options.ranking->column == station_column::stddev) {
+        options.features.variance = true;
+    }
+    if (options.window_seconds && options.numa) {
+        throw std::invalid_argument("--window reads in file order and cannot be combined with --numa");
+    }
+    if (options.window_seconds && options.grouping) {
+        throw std::invalid_argument("--window groups by station and cannot be combined with --group-by");
+    }
+    std::ranges::sort(options.filter.names);
+    return options;
+}
+
+// A tuning profile holds the parameters --tune picked for one host as
+// "key=value" lines. It is named after the host and applied before the
+// command line, so explicit options still win.
+[[nodiscard]] std::string host_name() {
+#if defined(__linux__)
+    auto name = std::array<char, 256>();
+    if (gethostname(name.data(), name.size() - 1) == 0 && name[0] != '\0') {
+        return name.data();
+    }
+#endif
+    return "localhost";
+}
+
+[[nodiscard]] std::filesystem::path default_profile_path() {
+    auto directory = std::filesystem::path(".");
+    if (const auto *config = std::getenv("XDG_CONFIG_HOME"); config != nullptr && *config != '\0') {
+        directory = std::filesystem::path(config) / "1brc";
+    } else if (const auto *home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        directory = std::filesystem::path(home) / ".config" / "1brc";
+    }
+    return directory / (host_name() + ".profile");
+}
+
+// The profile named by --profile=, the host default, or none for --no-profile.
+[[nodiscard]] std::optional<std::filesystem::path> profile_path(std::span<const std::string_view> args) {
+    auto path = std::optional(default_profile_path());
+    for (const auto arg : args) {
+        if (arg.starts_with("--profile=")) {
+            path = std::filesystem::path(arg.substr(10));
+        } else if (arg == "--no-profile") {
+            path.reset();
+        }
+    }
+    return path;
+}
+
+void save_profile(const std::filesystem::path &path, const run_options &options, size_t cpus) {
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+    auto file = std::ofstream(path);
+    file << "# tuned on " << host_name() << '\n'
+         << "cpus=" << cpus << '\n'
+         << "threads=" << options.threads.value_or(worker_count()) << '\n'
+         << "scheduler=" << scheduler_name(options.scheduler) << '\n'
+         << "chunk_bytes=" << options.chunk_bytes << '\n'
+         << "batch_bytes=" << options.batch_bytes << '\n'
+         << "queue_bulk=" << options.queue_bulk << '\n'
+         << "readers=" << options.readers << '\n';
+    if (!file) {
+        throw std::runtime_error("cannot write profile " + path.string());
+    }
+}
+
+// A missing profile leaves the defaults. A profile tuned for a different CPU
+// count is stale and ignored.
+void load_profile(const std::filesystem::path &path, run_options &options, size_t cpus) {
+    auto file = std::ifstream(path);
+    auto values = std::map<std::string, std::string, std::less<>>();
+    auto line = std::string();
+    while (std::getline(file, line)) {
+        const auto equals = line.find('=');
+        if (!line.starts_with('#') && equals != std::string::npos) {
+            values.emplace(line.substr(0, equals), line.substr(equals + 1));
+        }
+    }
+    if (values.empty()) {
+        return;
+    }
+    if (const auto it = values.find("cpus"); it == values.end() || std::stoull(it->second) != cpus) {
+        std::cerr << "ignoring profile " << path.string() << ", it was tuned for a different cpu count; rerun --tune\n";
+        return;
+    }
+
+    const auto number = [&](std::string_view key, auto &field) {
+        if (const auto it = values.find(key); it != values.end() && std::stoull(it->second) > 0) {
+            field = std::stoull(it->second);
+        }
+    };
+    number("threads", options.threads);
+    number("chunk_bytes", options.chunk_bytes);
+    number("batch_bytes", options.batch_bytes);
+    number("queue_bulk", options.queue_bulk);
+    number("readers", options.readers);
+    if (const auto it = values.find("scheduler"); it != values.end()) {
+        options.scheduler = parse_scheduler(it->second);
+    }
+}
+
+template <typename Hash, typename Storage>
+void run(const run_options &options, const execution_plan &plan, size_t thread_count) {
+    using table = aggregation_table<Hash, Storage>;
+    using shared_table = concurrent_aggregation_table<Hash>;
+
+    auto entries = std::vector<table>(thread_count);
+    auto shared = std::optional<shared_table>();
+    auto writers = std::vector<std::optional<typename shared_table::writer>>(thread_count);
+    if (plan.mode == table_mode::shared) {
+        shared.emplace(plan.table_capacity, options.features);
+    }
+
+    const auto placement = thread_placement(options.placement, options.scheduler == scheduler_kind::queue ? options.readers : 0);
+    auto reduction = tree_reduction<table>(entries);
+    const auto start = [&](auto &source) {
+        if (shared) {
+            return dispatch_threads(source, thread_count, placement, options.filter, options.grouping, [&](size_t i) -> typename shared_table::writer & {
+                return writers[i].emplace(*shared);
+            }, [&](size_t i){
+                writers[i]->flush();
+            });
+        }
+        return dispatch_threads(source, thread_count, placement, options.filter, options.grouping, [&](size_t i) -> table & {
+            entries[i] = table(plan.table_capacity, options.features);
+            return entries[i];
+        }, [&](size_t i){
+            reduction.arrive(i);
+        });
+    };
+
+    if (options.scheduler != scheduler_kind::queue) {
+        const auto input = mapped_file(options.input);
+        auto scheduler = range_scheduler(input.text(), thread_count, options.chunk_bytes);
+        for (auto &thread : start(scheduler)) {
+            thread.join();
+        }
+    } else {
+        // Each reader owns one line-aligned part of the file and its own
+        // producer token, so newline scanning scales with the readers.
+        const auto bounds = line_aligned_partitions(options.input, std::vector<size_t>(options.readers, 1));
+        auto batches = batch_channel<batch_descriptor>(options.queue_bulk, options.readers, options.queue_statistics);
+        auto pool = block_pool(pool_blocks(thread_count, options.readers), block_reader::block_bytes);
+        auto rows = std::atomic<std::uint64_t>(0);
+        auto readers = std::vector<std::thread>();
+        for (size_t r = 0; r < options.readers; r++) {
+            readers.emplace_back([&, r](){
+                placement.pin_producer(r);
+                auto producer = batch_channel<batch_descriptor>::producer(batches);
+                block_reader(options.input, pool, options.batch_bytes, bounds[r], bounds[r + 1]).read_all([&](const batch_descriptor &batch, std::string_view text) {
+                    if (options.queue_statistics) {
+                        rows += std::ranges::count(text, '\n');
+                    }
+                    producer.push(batch_descriptor(batch));
+                }, [&]() {
+                    producer.flush();
+                });
+                producer.close();
+            });
+        }
+
+        auto source = queue_source{batches, pool};
+        for (auto &thread : start(source)) {
+            thread.join();
+        }
+        for (auto &reader : readers) {
+            reader.join();
+        }
+        if (options.queue_statistics) {
+            print_queue_statistics<batch_descriptor>(std::cerr, batches.statistics_so_far(), rows);
+        }
+    }
+
+    if (shared && shared->overflowed()) {
+        std::cerr << "shared aggregation table is full, rerunning with per-thread tables\n";
+        auto fallback = plan;
+        fallback.mode = table_mode::per_thread;
+        run<Hash, Storage>(options, fallback, thread_count);
+        return;
+    }
+
+    const auto output = [&](const table &data) {
+        output_batch(data, options.ranking ? ranked_slots(data, *options.ranking) : data.sorted_slots());
+    };
+    if (shared) {
+        auto data = table(plan.table_capacity, options.features);
+        shared->merge_into(data);
+        output(data);
+    } else {
+        output(reduction.result());
+    }
+}
+
+// Streams one "<window start> {...}" line per window as soon as the window
+// closes, so memory holds the open windows only. Each worker's open tables
+// are handed to a shared pending map once the watermark passes them; a
+// window is printed when every worker has handed its share over. Rows that
+// arrive for an already printed window are counted and dropped. The
+// watermark needs sequence numbers in file order, so --readers is ignored
+// here and one thread reads.
+template <typename Hash, typename Storage>
+void run_windowed(const run_options &options, const execution_plan &plan, size_t thread_count) {
+    using table = aggregation_table<Hash, Storage>;
+
+    using channel = batch_channel<batch_descriptor>;
+
+    const auto width = *options.window_seconds;
+    auto batches = channel(options.queue_bulk, 1, options.queue_statistics);
+    auto pool = block_pool(pool_blocks(thread_count), block_reader::block_bytes);
+    auto rows = std::uint64_t(0);
+    auto watermark = window_watermark();
+    const auto placement = thread_placement(options.placement, 1);
+
+    auto producer_thread = std::thread([&](){
+        placement.pin_producer();
+        auto producer = channel::producer(batches);
+        block_reader(options.input, pool, options.batch_bytes).read_all([&](const batch_descriptor &batch, std::string_view text) {
+            if (options.queue_statistics) {
+                rows += std::ranges::count(text, '\n');
+            }
+            watermark.started(batch.sequence, window_start(split_timestamped(text.substr(0, text.find('\n'))).timestamp, width));
+            producer.push(batch_descriptor(batch));
+        }, [&]() {
+            producer.flush();
+        });
+        producer.close();
+    });
+
+    auto pending_mutex = std::mutex();
+    auto pending = std::map<std::int64_t, table>();
+    auto released = std::vector<std::atomic<std::int64_t>>(thread_count);
+    for (auto &bound : released) {
+        bound = std::numeric_limits<std::int64_t>::min();
+    }
+    auto late_rows = std::atomic<size_t>(0);
+
+    const auto hand_over = [&](size_t worker, window_tables<table> &windows, std::int64_t bound) {
+        auto lock = std::lock_guard(pending_mutex);
+        windows.release_before(bound, [&](std::int64_t window, table &&data) {
+            auto [it, inserted] = pending.try_emplace(window, std::move(data));
+            if (!inserted) {
+                it->second.merge(data);
+            }
+        });
+        released[worker] = bound;
+
+        auto closed = std::numeric_limits<std::int64_t>::max();
+        for (const auto &other : released) {
+            closed = std::min(closed, other.load());
+        }
+        const auto end = pending.lower_bound(closed);
+        for (auto it = pending.begin(); it != end; ++it) {
+            std::cout << it->first << ' ';
+            output_batch(it->second, options.ranking ? ranked_slots(it->second, *options.ranking) : it->second.sorted_slots());
+            std::cout << '\n';
+        }
+        pending.erase(pending.begin(), end);
+    };
+
+    auto threads = std::vector<std::thread>();
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i](){
+            placement.pin_worker(i);
+            auto windows = window_tables<table>(plan.table_capacity, options.features);
+            with_matcher<Hash>(options.filter, [&](auto &matcher) {
+                auto late = size_t(0);
+
+                const auto process = [&](const batch_descriptor &batch) {
+                    for_each_line(pool.text(batch), [&](std::string_view line) {
+                        const auto row = split_timestamped(line);
+                        const auto hash = table::hash(row.station);
+                        if (!matcher.accepts(row.station, hash)) {
+                            return;
+                        }
+                        auto *data = windows.find_or_open(window_start(row.timestamp, width));
+                        if (data == nullptr) {
+                            late++;
+                            return;
+                        }
+                        data->add(row.station, hash, parse_tenths(row.value));
+                    });
+                    pool.release(batch.block);
+                    // Parked workers may be holding windows this batch just closed.
+                    if (watermark.completed(batch.sequence)) {
+                        batches.wake();
+                    }
+                };
+                const auto release_closed = [&]() {
+                    if (const auto closed = watermark.closed_before(); closed > windows.released_before()) {
+                        hand_over(i, windows, closed);
+                    }
+                };
+
+                auto consumer = channel::consumer(batches);
+                while (const auto *item = consumer.pop(release_closed)) {
+                    process(*item);
+                    release_closed();
+                }
+                hand_over(i, windows, std::numeric_limits<std::int64_t>::max());
+                late_rows += late;
+            });
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    producer_thread.join();
+
+    if (options.queue_statistics) {
+        print_queue_statistics<batch_descriptor>(std::cerr, batches.statistics_so_far(), rows);
+    }
+    if (late_rows > 0) {
+        std::cerr << late_rows << " rows arrived after their window was flushed and were dropped\n";
+    }
+}
+
+// Bytes [begin, end) of a file, read by the calling thread so the pages are
+// first touched, and therefore placed, on its node.
+[[nodiscard]] std::string read_file_range(const std::filesystem::path &path, size_t begin, size_t end) {
+    auto file = std::ifstream(path, std::ios::binary);
+    auto buffer = std::string(end - begin, ' ');
+    file.seekg(static_cast<std::streamoff>(begin));
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    return buffer;
+}
+
+// One worker group per NUMA node. Each node's share of the input is read by a
+// thread pinned to that node, so the partition lives in local memory. The
+// node's workers, pinned to its CPUs, steal only among themselves and fill
+// node-local tables. Those are tree-reduced on the node, and only one table
+// per node crosses the interconnect in the final merge. Workers are dealt to
+// nodes round-robin and input bytes follow the worker counts.
+template <typename Hash, typename Storage>
+void run_numa(const run_options &options, const execution_plan &plan, size_t thread_count, const std::vector<std::vector<unsigned>> &nodes) {
+    using table = aggregation_table<Hash, Storage>;
+
+    const auto node_count = std::min(nodes.size(), thread_count);
+    auto workers = std::vector<size_t>(node_count);
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i % node_count]++;
+    }
+    const auto bounds = line_aligned_partitions(options.input, workers);
+
+    auto partitions = std::vector<std::string>(node_count);
+    auto loaders = std::vector<std::thread>();
+    for (size_t node = 0; node < node_count; node++) {
+        loaders.emplace_back([&, node](){
+            thread_placement(nodes[node]).pin_worker(0);
+            partitions[node] = read_file_range(options.input, bounds[node], bounds[node + 1]);
+        });
+    }
+    for (auto &loader : loaders) {
+        loader.join();
+    }
+
+    auto entries = std::vector<std::vector<table>>(node_count);
+    auto reductions = std::vector<std::optional<tree_reduction<table>>>(node_count);
+    auto schedulers = std::vector<std::optional<range_scheduler>>(node_count);
+    auto placements = std::vector<thread_placement>();
+    for (size_t node = 0; node < node_count; node++) {
+        entries[node].resize(workers[node]);
+        reductions[node].emplace(entries[node]);
+        schedulers[node].emplace(partitions[node], workers[node], options.chunk_bytes);
+        placements.emplace_back(nodes[node]);
+    }
+
+    auto threads = std::vector<std::thread>();
+    for (size_t node = 0; node < node_count; node++) {
+        auto group = dispatch_threads(*schedulers[node], workers[node], placements[node], options.filter, options.grouping, [&, node](size_t i) -> table & {
+            entries[node][i] = table(plan.table_capacity, options.features);
+            return entries[node][i];
+        }, [&, node](size_t i){
+            reductions[node]->arrive(i);
+        });
+        std::ranges::move(group, std::back_inserter(threads));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    auto &result = entries.front().front();
+    for (size_t node = 1; node < node_count; node++) {
+        result.merge(reductions[node]->result());
+    }
+    output_batch(result, options.ranking ? ranked_slots(result, *options.ranking) : result.sorted_slots());
+}
+
+template <typename T>
+struct task_result {
+    void return_value(T result) { value = std::move(result); }
+    T take() { return std::move(*value); }
+
+    std::optional<T> value;
+};
+
+template <>
+struct task_result<void> {
+    void return_void() {}
+    void take() {}
+};
+
+// A lazily started coroutine. Awaiting it runs it on the awaiting thread
+// until it suspends; when it finishes, the awaiter resumes on whichever
+// thread finished it.
+template <typename T = void>
+class [[nodiscard]] task {
+public:
+    struct promise_type : task_result<T> {
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> coroutine) noexcept {
+                return coroutine.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr error;
+    };
+
+    task(task &&other) noexcept : coroutine(std::exchange(other.coroutine, {})) {}
+    task &operator=(task &&) = delete;
+
+    ~task() {
+        if (coroutine) {
+            coroutine.destroy();
+        }
+    }
+
+    auto operator co_await() noexcept {
+        struct awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                coroutine.promise().continuation = awaiting;
+                return coroutine;
+            }
+            T await_resume() {
+                if (coroutine.promise().error) {
+                    std::rethrow_exception(coroutine.promise().error);
+                }
+                return coroutine.promise().take();
+            }
+
+            std::coroutine_handle<promise_type> coroutine;
+        };
+        return awaiter{coroutine};
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+    std::coroutine_handle<promise_type> coroutine;
+};
+
+// A coroutine that starts at once and frees itself when done. Only the
+// joins below use it.
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// A fixed set of threads resuming posted coroutines in FIFO order. A
+// coroutine moves onto the pool with co_await schedule().
+class executor {
+public:
+    // Setup runs first on each pool thread, once it is pinned, so whatever
+    // it builds is first touched there. The constructor returns once every
+    // thread has run it.
+    template <typename Setup>
+    executor(size_t thread_count, const thread_placement &placement, Setup setup) : started(std::ptrdiff_t(thread_count)) {
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([this, &placement, setup, i](){
+                placement.pin_worker(i);
+                worker = i;
+                setup(i);
+                started.count_down();
+                while (const auto coroutine = next()) {
+                    coroutine.resume();
+                }
+            });
+        }
+        started.wait();
+    }
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    // Runs out the queue, then joins.
+    ~executor() {
+        {
+            auto lock = std::lock_guard(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    void post(std::coroutine_handle<> coroutine) {
+        {
+            auto lock = std::lock_guard(mutex);
+            queue.push_back(coroutine);
+        }
+        ready.notify_one();
+    }
+
+    [[nodiscard]] auto schedule() {
+        struct awaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> coroutine) { pool.post(coroutine); }
+            void await_resume() noexcept {}
+
+            executor &pool;
+        };
+        return awaiter{*this};
+    }
+
+    // The pool index of the calling thread.
+    [[nodiscard]] static size_t current_worker() { return worker; }
+
+private:
+    [[nodiscard]] std::coroutine_handle<> next() {
+        auto lock = std::unique_lock(mutex);
+        ready.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return {};
+        }
+        const auto coroutine = queue.front();
+        queue.pop_front();
+        return coroutine;
+    }
+
+    static inline thread_local size_t worker = 0;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::coroutine_handle<>> queue;
+    bool stopping = false;
+    std::latch started;
+    std::vector<std::thread> threads;
+};
+
+// Awaits a group of tasks. They are started on the awaiting thread, so each
+// should begin with co_await schedule() to spread over the pool. The last
+// one to finish resumes the awaiter. The first error is rethrown.
+class when_all {
+public:
+    explicit when_all(std::vector<task<>> tasks) : tasks(std::move(tasks)), remaining(this->tasks.size() + 1) {}
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) {
+        parent = awaiting;
+        for (auto &work : tasks) {
+            start(work, *this);
+        }
+        // The extra count keeps early finishers from resuming the parent
+        // before every task is started.
+        return remaining.fetch_sub(1) != 1;
+    }
+
+    void await_resume() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    static detached start(task<> &work, when_all &group) {
+        try {
+            co_await work;
+        } catch (...) {
+            auto lock = std::lock_guard(group.mutex);
+            if (!group.error) {
+                group.error = std::current_exception();
+            }
+        }
+        if (group.remaining.fetch_sub(1) == 1) {
+            group.parent.resume();
+        }
+    }
+
+    std::vector<task<>> tasks;
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> parent;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+// Blocks the calling thread until the task is done.
+void sync_wait(task<> work) {
+    auto mutex = std::mutex();
+    auto finished = std::condition_variable();
+    auto done = false;
+    auto error = std::exception_ptr();
+    [](task<> &work, std::mutex &mutex, std::condition_variable &finished, bool &done, std::exception_ptr &error) -> detached {
+        try {
+            co_await work;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        auto lock = std::lock_guard(mutex);
+        done = true;
+        finished.notify_one();
+    }(work, mutex, finished, done, error);
+
+    auto lock = std::unique_lock(mutex);
+    finished.wait(lock, [&]() { return done; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// The pipeline as coroutine stages on a small executor. Split cuts the file
+// into line-aligned chunks of a read block each. Lanes, a few per pool
+// thread, loop over the chunks: a lane awaits the read of its next chunk
+// into its buffer and is resumed on the thread that completed the read to
+// parse and aggregate it into that thread's table, so while one lane reads
+// another parses. The per-thread tables are then merged pairwise, each merge
+// its own task, and the output stage prints the result. Every pool thread
+// builds its own table and reader state, and the lane buffers come from a
+// fixed block_pool, so no chunk allocates.
+template <typename Hash, typename Storage>
+void run_coroutines(const run_options &options, const execution_plan &plan, size_t thread_count) {
+    using table = aggregation_table<Hash, Storage>;
+    using shared_table = concurrent_aggregation_table<Hash>;
+    constexpr auto lanes_per_thread = size_t(2);
+
+    const auto size = size_t(std::filesystem::file_size(options.input));
+    const auto chunk_count = std::max<size_t>(1, (size + block_reader::block_bytes - 1) / block_reader::block_bytes);
+    const auto bounds = line_aligned_partitions(options.input, std::vector<size_t>(chunk_count, 1));
+    auto largest = size_t(1);
+    for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+        largest = std::max(largest, bounds[chunk + 1] - bounds[chunk]);
+    }
+    const auto lane_count = lanes_per_thread * thread_count;
+    auto buffers = block_pool(lane_count, largest);
+
+    auto shared = std::optional<shared_table>();
+    if (plan.mode == table_mode::shared) {
+        shared.emplace(plan.table_capacity, options.features);
+    }
+    auto entries = std::vector<table>(shared ? 0 : thread_count);
+    auto writers = std::vector<std::optional<typename shared_table::writer>>(thread_count);
+    auto matchers = std::vector<std::optional<station_matcher<Hash>>>(thread_count);
+    auto extractors = std::vector<std::optional<key_extractor>>(thread_count);
+    auto files = std::vector<std::ifstream>(thread_count);
+
+    const auto placement = thread_placement(options.placement, 0);
+    auto pool = executor(thread_count, placement, [&](size_t i) {
+        if (shared) {
+            writers[i].emplace(*shared);
+        } else {
+            entries[i] = table(plan.table_capacity, options.features);
+        }
+        if (options.filter.active()) {
+            matchers[i].emplace(options.filter);
+        }
+        if (options.grouping) {
+            extractors[i].emplace(*options.grouping);
+        }
+        files[i].open(options.input, std::ios::binary);
+    });
+    auto next_chunk = std::atomic<size_t>(0);
+
+    const auto read = [&](size_t chunk, std::uint32_t buffer) -> task<std::string_view> {
+        co_await pool.schedule();
+        auto &file = files[executor::current_worker()];
+        const auto length = bounds[chunk + 1] - bounds[chunk];
+        file.seekg(static_cast<std::streamoff>(bounds[chunk]));
+        file.read(buffers.data(buffer), static_cast<std::streamsize>(length));
+        co_return std::string_view(buffers.data(buffer), length);
+    };
+    const auto aggregate = [&](size_t worker, std::string_view text) {
+        const auto into = [&](auto &data, auto &&matcher) {
+            if (extractors[worker]) {
+                process_batch(text, data, matcher, *extractors[worker]);
+            } else {
+                process_batch(text, data, matcher);
+            }
+        };
+        const auto filtered = [&](auto &data) {
+            if (matchers[worker]) {
+                into(data, *matchers[worker]);
+            } else {
+                into(data, accept_all());
+            }
+        };
+        if (shared) {
+            filtered(*writers[worker]);
+        } else {
+            filtered(entries[worker]);
+        }
+    };
+    const auto lane = [&]() -> task<> {
+        // One buffer per lane, and the pool holds one per lane.
+        const auto buffer = buffers.acquire([](){});
+        for (auto chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+            const auto text = co_await read(chunk, buffer);
+            aggregate(executor::current_worker(), text);
+        }
+        buffers.release(buffer);
+    };
+    const auto merge = [&](size_t into, size_t from) -> task<> {
+        co_await pool.schedule();
+        entries[into].merge(entries[from]);
+    };
+    const auto output = [&]() -> task<> {
+        co_await pool.schedule();
+        if (shared) {
+            auto data = table(plan.table_capacity, options.features);
+            shared->merge_into(data);
+            output_batch(data, options.ranking ? ranked_slots(data, *options.ranking) : data.sorted_slots());
+        } else {
+            const auto &data = entries.front();
+            output_batch(data, options.ranking ? ranked_slots(data, *options.ranking) : data.sorted_slots());
+        }
+    };
+    const auto pipeline = [&]() -> task<> {
+        auto lanes = std::vector<task<>>();
+        for (size_t i = 0; i < lane_count; i++) {
+            lanes.push_back(lane());
+        }
+        co_await when_all(std::move(lanes));
+        if (shared && shared->overflowed()) {
+            co_return;
+        }
+        for (auto &writer : writers) {
+            if (writer) {
+                writer->flush();
+            }
+        }
+        for (size_t step = 1; step < entries.size(); step *= 2) {
+            auto merges = std::vector<task<>>();
+            for (size_t i = 0; i + step < entries.size(); i += 2 * step) {
+                merges.push_back(merge(i, i + step));
+            }
+            co_await when_all(std::move(merges));
+        }
+        co_await output();
+    };
+    sync_wait(pipeline());
+
+    if (shared && shared->overflowed()) {
+        std::cerr << "shared aggregation table is full, rerunning with per-thread tables\n";
+        auto fallback = plan;
+        fallback.mode = table_mode::per_thread;
+        run_coroutines<Hash, Storage>(options, fallback, thread_count);
+    }
+}
+
+template <typename Hash>
+void run_with_layout(const run_options &options, const execution_plan &plan, size_t thread_count) {
+    if (options.numa) {
+        if (options.struct_of_arrays) {
+            run_numa<Hash, struct_of_arrays>(options, plan, thread_count, read_numa_nodes());
+        } else {
+            run_numa<Hash, array_of_structs>(options, plan, thread_count, read_numa_nodes());
+        }
+    } else if (options.window_seconds) {
+        if (options.struct_of_arrays) {
+            run_windowed<Hash, struct_of_arrays>(options, plan, thread_count);
+        } else {
+            run_windowed<Hash, array_of_structs>(options, plan, thread_count);
+        }
+    } else if (options.scheduler == scheduler_kind::coroutines) {
+        if (options.struct_of_arrays) {
+            run_coroutines<Hash, struct_of_arrays>(options, plan, thread_count);
+        } else {
+            run_coroutines<Hash, array_of_structs>(options, plan, thread_count);
+        }
+    } else if (options.struct_of_arrays) {
+        run<Hash, struct_of_arrays>(options, plan, thread_count);
+    } else {
+        run<Hash, array_of_structs>(options, plan, thread_count);
+    }
+}
+
+void run_planned(const run_options &options, const execution_plan &plan, size_t thread_count) {
+    if (plan.full_key_hash) {
+        run_with_layout<wy_hash>(options, plan, thread_count);
+    } else {
+        run_with_layout<station_hash>(options, plan, thread_count);
+    }
+}
+
+// Full runs over a real input under every placement policy and every
+// scheduler. Output is discarded; the first pass only warms the page cache.
+void benchmark_placement(const std::filesystem::path &input) {
+    const auto thread_count = worker_count();
+    const auto policies = std::array{
+        std::pair{placement_policy::none, "none"},
+        std::pair{placement_policy::compact, "compact"},
+        std::pair{placement_policy::scatter, "scatter"},
+        std::pair{placement_policy::physical, "physical"},
+    };
+
+    auto results = std::ostringstream();
+    auto discard = std::ostringstream();
+    auto *const console = std::cout.rdbuf(discard.rdbuf());
+    for (const auto scheduler : {scheduler_kind::ranges, scheduler_kind::queue, scheduler_kind::coroutines}) {
+        for (const auto &[policy, name] : policies) {
+            auto options = run_options();
+            options.input = input;
+            options.scheduler = scheduler;
+            options.placement = policy;
+            const auto plan = plan_execution(options.input, options.mode, options.estimated_stations, thread_count);
+            run_with_layout<station_hash>(options, plan, thread_count);
+            const auto elapsed = time_ms([&](){
+                run_with_layout<station_hash>(options, plan, thread_count);
+            });
+            results << std::setw(8) << name << ' ' << std::setw(10) << scheduler_name(scheduler) << ": "
+                    << std::fixed << std::setprecision(2) << std::setw(10) << elapsed << " ms\n";
+            discard.str({});
+        }
+    }
+    std::cout.rdbuf(console);
+
+    std::cout << thread_count << " workers, " << read_cpu_topology().size() << " cpus\n" << results.str();
+}
+
+// Calibrates this host on a line-aligned sample from the head of the input
+// and saves the winner as its profile. The search is one parameter at a time:
+// the worker count under the range scheduler, then its chunk size, then the
+// queue path's batch bytes, bulk size and reader count at the chosen worker
+// count, and last the scheduler itself. Each point is the best of two runs,
+// with output discarded.
+void tune(const run_options &base, const std::filesystem::path &profile) {
+    constexpr auto sample_bytes = size_t(64) << 20;
+    const auto size = size_t(std::filesystem::file_size(base.input));
+    auto sample_text = read_file_range(base.input, 0, std::min(size, sample_bytes));
+    if (sample_text.size() < size) {
+        sample_text.resize(sample_text.rfind('\n') + 1);
+    }
+    const auto sample = std::filesystem::temp_directory_path() / ("1brc-tune-" + host_name() + ".txt");
+    std::ofstream(sample, std::ios::binary).write(sample_text.data(), static_cast<std::streamsize>(sample_text.size()));
+
+    auto best = base;
+    best.input = sample;
+    best.scheduler = scheduler_kind::ranges;
+
+    auto discard = std::ostringstream();
+    const auto measure = [&](const run_options &options) {
+        const auto thread_count = *options.threads;
+        const auto plan = plan_execution(options.input, options.mode, options.estimated_stations, thread_count, options.grouping);
+        auto *const console = std::cout.rdbuf(discard.rdbuf());
+        auto elapsed = std::numeric_limits<double>::max();
+        for (int i = 0; i < 2; i++) {
+            elapsed = std::min(elapsed, time_ms([&](){
+                run_planned(options, plan, thread_count);
+            }));
+            discard.str({});
+        }
+        std::cout.rdbuf(console);
+        std::cout << std::setw(3) << thread_count << " threads " << std::setw(10) << scheduler_name(options.scheduler)
+                  << " chunk " << std::setw(8) << options.chunk_bytes << " batch " << std::setw(7) << options.batch_bytes
+                  << " bulk " << std::setw(3) << options.queue_bulk << " readers " << options.readers << ": "
+                  << std::fixed << std::setprecision(2) << std::setw(10) << elapsed << " ms\n";
+        return elapsed;
+    };
+    // Tries each value of one field and keeps the fastest, returning its time.
+    const auto search = [&](auto field, const auto &values) {
+        auto best_ms = std::numeric_limits<double>::max();
+        auto winner = best.*field;
+        for (const auto value : values) {
+            auto candidate = best;
+            candidate.*field = value;
+            if (const auto elapsed = measure(candidate); elapsed < best_ms) {
+                best_ms = elapsed;
+                winner = value;
+            }
+        }
+        best.*field = winner;
+        return best_ms;
+    };
+
+    const auto cpus = std::max<size_t>(1, read_cpu_topology().size());
+    auto thread_counts = std::vector<size_t>();
+    for (size_t count = 1; count < cpus; count *= 2) {
+        thread_counts.push_back(count);
+    }
+    thread_counts.push_back(std::max<size_t>(1, cpus - 1));
+    thread_counts.push_back(cpus);
+    std::ranges::sort(thread_counts);
+    thread_counts.erase(std::ranges::unique(thread_counts).begin(), thread_counts.end());
+
+    best.threads = worker_count();
+    search(&run_options::threads, thread_counts | std::views::transform([](size_t count) { return std::optional(count); }));
+    search(&run_options::chunk_bytes, std::array<size_t, 4>{16 << 10, 64 << 10, 256 << 10, 1 << 20});
+
+    if (!base.numa) {
+        best.scheduler = scheduler_kind::queue;
+        search(&run_options::batch_bytes, std::array<size_t, 3>{4 << 10, 16 << 10, 64 << 10});
+        search(&run_options::queue_bulk, std::array<size_t, 3>{1, 8, 32});
+        search(&run_options::readers, std::array<size_t, 3>{1, 2, 4});
+        search(&run_options::scheduler, std::array{scheduler_kind::ranges, scheduler_kind::queue, scheduler_kind::coroutines});
+    }
+    std::filesystem::remove(sample);
+
+    save_profile(profile, best, cpus);
+    std::cout << "saved " << profile.string() << ": " << *best.threads << " threads, "
+              << scheduler_name(best.scheduler) << " scheduler\n";
+}
+
+int main(int argc, char **argv) {
+    try {
+        const auto args = std::vector<std::string_view>(argv + 1, argv + argc);
+        if (args.size() == 2 && args[0] == "--bench-hash") {
+            benchmark_hashes(args[1]);
+            return 0;
+        }
+
+        if (args.size() == 1 && args[0] == "--bench-tables") {
+            benchmark_tables(worker_count());
+            return 0;
+        }
+
+        if (args.size() == 1 && args[0] == "--bench-merge") {
+            benchmark_merge();
+            return 0;
+        }
+
+        if (args.size() == 2 && args[0] == "--bench-placement") {
+            benchmark_placement(args[1]);
+            return 0;
+        }
+
+        if (args.size() == 1 && args[0] == "--check-sampler") {
+            return check_sampler() ? 0 : 1;
+        }
+
+        if (args.size() == 1 && args[0] == "--bench-layouts") {
+            benchmark_layouts();
+            return 0;
+        }
+
+        const auto profile = profile_path(args);
+        auto defaults = run_options();
+        if (profile && std::ranges::find(args, std::string_view("--tune")) == args.end()) {
+            load_profile(*profile, defaults, std::max<size_t>(1, read_cpu_topology().size()));
+        }
+        const auto options = parse_options(args, std::move(defaults));
+        if (options.tune) {
+            tune(options, profile.value_or(default_profile_path()));
+            return 0;
+        }
+
+        const auto thread_count = options.threads.value_or(worker_count());
+        const auto plan = plan_execution(options.input, options.mode, options.estimated_stations, thread_count, options.grouping);
+        if (options.print_plan) {
+            std::cerr << "estimated stations: " << plan.estimated_stations
+                      << ", table capacity: " << plan.table_capacity
+                      << ", tables: " << (plan.mode == table_mode::shared ? "shared" : "per-thread")
+                      << ", hash: " << (plan.full_key_hash ? wy_hash::name : station_hash::name) << '\n';
+        }
+
+        const auto wall_start = std::chrono::steady_clock::now();
+        const auto cpu_start = std::clock();
+        run_planned(options, plan, thread_count);
+        if (options.print_timing) {
+            // std::clock is process CPU time, summed over every thread.
+            const auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+            const auto cpu = 1'000.0 * static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+            std::cerr << std::fixed << std::setprecision(1)
+                      << "wall: " << wall << " ms, cpu: " << cpu << " ms, cpu/wall: " << std::setprecision(2) << cpu / wall << '\n';
+        }
+
+        return 0;
+    } catch (const std::exception &error) {
+        std::cerr << "error: " << error.what() << '\n';
+        return 1;
+    }
 }